@@ -0,0 +1,304 @@
+// Offscreen frame-time benchmark for Keyboard and MainWindow.
+//
+// Replays hover sweeps, flicker cycles, resizes and confidence changes and reports per-event
+// time percentiles and heap allocation counts. Anything that shows up here stalls the GUI
+// thread, and with it the delivery of signals to the synth.
+//
+// QT_QPA_PLATFORM defaults to offscreen, so this runs without a display.
+
+#include "keyboard.h"
+#include "mainwindow.h"
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QHoverEvent>
+#include <QTextStream>
+#include <QWheelEvent>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <optional>
+#include <random>
+#include <vector>
+
+static std::atomic<quint64> allocations{0};
+
+void * operator new(std::size_t size) {
+    ++allocations;
+    if (void * const p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void * p) noexcept { std::free(p); }
+void operator delete(void * p, std::size_t) noexcept { std::free(p); }
+
+class KeyboardBenchmark {
+public:
+    struct Sample {
+        qint64 ns;
+        quint64 allocations;
+    };
+
+    class Series {
+    public:
+        explicit Series(QString name): name{name} {}
+
+        template <typename F>
+        void measure(F && f) {
+            quint64 const allocations_before = allocations;
+            QElapsedTimer timer;
+            timer.start();
+            f();
+            this->samples.push_back({timer.nsecsElapsed(), allocations - allocations_before});
+        }
+
+        void add(Sample sample) {
+            this->samples.push_back(sample);
+        }
+
+        void report(QTextStream & out) {
+            if (this->samples.empty()) return;
+            std::sort(this->samples.begin(), this->samples.end(), [](Sample a, Sample b) { return a.ns < b.ns; });
+            auto const percentile = [this](double p) {
+                return this->samples[static_cast<size_t>(p * (this->samples.size() - 1))].ns / 1000.;
+            };
+            quint64 total_allocations = 0;
+            for (auto const& sample : this->samples) total_allocations += sample.allocations;
+
+            out << QString("  %1 %2 %3 %4 %5 %6 %7\n")
+                   .arg(this->name, -24)
+                   .arg(this->samples.size(), 7)
+                   .arg(percentile(0.5), 10, 'f', 1)
+                   .arg(percentile(0.9), 10, 'f', 1)
+                   .arg(percentile(0.99), 10, 'f', 1)
+                   .arg(this->samples.back().ns / 1000., 10, 'f', 1)
+                   .arg(double(total_allocations) / this->samples.size(), 10, 'f', 1);
+        }
+
+    private:
+        QString name;
+        std::vector<Sample> samples;
+    };
+
+    // Records the clock and the allocation count at the first Paint the watched widget gets
+    class FirstPaint : public QObject {
+    public:
+        FirstPaint(QObject * watched, QElapsedTimer const& clock): clock{clock} {
+            watched->installEventFilter(this);
+        }
+
+        std::optional<Sample> sample;
+
+    protected:
+        bool eventFilter(QObject *, QEvent * event) override {
+            if (event->type() == QEvent::Paint && !this->sample) {
+                this->sample = Sample{this->clock.nsecsElapsed(), allocations};
+            }
+            return false;
+        }
+
+    private:
+        QElapsedTimer const& clock;
+    };
+
+    explicit KeyboardBenchmark(QTextStream & out): out{out}, random{42} {}
+
+    void header() {
+        this->out << QString("  %1 %2 %3 %4 %5 %6 %7\n")
+                     .arg("event", -24).arg("count", 7)
+                     .arg("p50 us", 10).arg("p90 us", 10).arg("p99 us", 10).arg("max us", 10)
+                     .arg("allocs", 10);
+    }
+
+    void keyboard(Synth::Note lowest, Synth::Note highest, QSize size) {
+        Keyboard kb(lowest, highest);
+        kb.resize(size);
+        kb.show();
+        QCoreApplication::processEvents();
+
+        this->out << QString("Keyboard %1-%2 (%3 keys) at %4x%5\n")
+                     .arg(lowest).arg(highest).arg(kb.key_rects.size())
+                     .arg(size.width()).arg(size.height());
+        this->header();
+
+        int const white_row = kb.target.top() + kb.target.height() * 3 / 4;
+        int const black_row = kb.target.top() + kb.target.height() / 4;
+
+        // Hover sweeps, including the paint they cause
+        Series hover("hover sweep");
+        for (int const row : {white_row, black_row}) {
+            QPoint previous(-1, row);
+            for (int x = 0; x < kb.width(); ++x) {
+                QPoint const pos(x, row);
+                hover.measure([&]() {
+                    QHoverEvent e(QEvent::HoverMove, pos, previous);
+                    QCoreApplication::sendEvent(&kb, &e);
+                    QCoreApplication::processEvents();
+                });
+                previous = pos;
+            }
+        }
+        hover.report(this->out);
+
+        // Confidence changes with the pointer parked in the middle
+        Series confidence("confidence change");
+        kb.last_hover_pos = QPoint(kb.target.center().x(), white_row);
+        for (int i = 0; i < 200; ++i) {
+            confidence.measure([&]() {
+                kb.change_confidence(i % 13);
+                QCoreApplication::processEvents();
+            });
+        }
+        confidence.report(this->out);
+        kb.change_confidence(0);
+
+        // Flicker cycles of random correct notes
+        Series flicker("flicker cycle");
+        std::uniform_int_distribution<int> key_distribution(0, kb.key_rects.size() - 1);
+        for (int i = 0; i < 200; ++i) {
+            Synth::Note const note(kb.lowest + key_distribution(this->random));
+            kb.flicker_correct(note);
+            for (int toggle = 0; toggle < 4; ++toggle) {
+                flicker.measure([&]() {
+                    kb.flicker();
+                    QCoreApplication::processEvents();
+                });
+            }
+        }
+        flicker.report(this->out);
+
+        // Paint cost in isolation: full frame and a single key
+        QPixmap frame(kb.size());
+        Series full_compose("compose full frame");
+        Series key_compose("compose one key");
+        for (int i = 0; i < 100; ++i) {
+            QRegion const key_region = kb.key_regions[key_distribution(this->random)];
+            full_compose.measure([&]() {
+                QPainter p(&frame);
+                kb.compose(p, QRegion(kb.rect()));
+            });
+            key_compose.measure([&]() {
+                QPainter p(&frame);
+                kb.compose(p, key_region);
+            });
+        }
+        full_compose.report(this->out);
+        key_compose.report(this->out);
+
+        Series cold_range("range_region cold");
+        Series warm_range("range_region warm");
+        std::uniform_int_distribution<int> confidence_distribution(0, 12);
+        for (int i = 0; i < 1000; ++i) {
+            int const key = key_distribution(this->random);
+            int const cf = confidence_distribution(this->random);
+            kb.range_cache.clear();
+            cold_range.measure([&]() { kb.range_region(key - cf, key + cf); });
+            warm_range.measure([&]() { kb.range_region(key - cf, key + cf); });
+        }
+        cold_range.report(this->out);
+        warm_range.report(this->out);
+
+        Series hit_test("key_from_pos");
+        std::uniform_int_distribution<int> x_distribution(0, kb.width() - 1);
+        std::uniform_int_distribution<int> y_distribution(0, kb.height() - 1);
+        volatile int sink = 0;
+        for (int i = 0; i < 10000; ++i) {
+            QPoint const pos(x_distribution(this->random), y_distribution(this->random));
+            hit_test.measure([&]() { sink = kb.key_from_pos(pos); });
+        }
+        hit_test.report(this->out);
+
+        // Resizes relayout and repaint the whole widget
+        Series resize("resize");
+        for (int i = 0; i < 50; ++i) {
+            QSize const new_size = size + QSize((i % 2) ? 13 : -13, (i % 2) ? 5 : -5);
+            resize.measure([&]() {
+                kb.resize(new_size);
+                QCoreApplication::processEvents();
+            });
+        }
+        resize.report(this->out);
+        this->out << "\n";
+        this->out.flush();
+    }
+
+    void mainwindow() {
+        this->out << "MainWindow\n";
+        this->header();
+
+        // Stops at the paint itself, so neither the event loop's idle time after it nor tearing
+        // the window down (joining the synth thread, writing the log summary) is counted
+        Series startup("construct to first paint");
+        for (int i = 0; i < 5; ++i) {
+            quint64 const allocations_before = allocations;
+            QElapsedTimer clock;
+            clock.start();
+            MainWindow w(clock);
+            FirstPaint const painted(&w, clock);
+            w.show();
+            QElapsedTimer timeout;
+            timeout.start();
+            while (!painted.sample && timeout.elapsed() < 5000) {
+                QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+            }
+            if (!painted.sample) {
+                this->out << "  MainWindow was not painted within 5 s\n";
+                continue;
+            }
+            startup.add({painted.sample->ns, painted.sample->allocations - allocations_before});
+        }
+        startup.report(this->out);
+
+        QElapsedTimer clock;
+        clock.start();
+        MainWindow w(clock);
+        w.show();
+        QCoreApplication::processEvents();
+
+        Series wheel("wheel confidence");
+        QPointF const pos = w.rect().center();
+        for (int i = 0; i < 200; ++i) {
+            QPoint const delta(0, (i / 12) % 2 ? -120 : 120);
+            wheel.measure([&]() {
+                QWheelEvent e(pos, w.mapToGlobal(pos.toPoint()), QPoint(), delta, Qt::NoButton, Qt::NoModifier, Qt::NoScrollPhase, false);
+                QCoreApplication::sendEvent(&w, &e);
+                QCoreApplication::processEvents();
+            });
+        }
+        wheel.report(this->out);
+        this->out.flush();
+    }
+
+private:
+    QTextStream & out;
+    std::mt19937 random;
+};
+
+int main(int argc, char *argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication a(argc, argv);
+    QTextStream out(stdout);
+    KeyboardBenchmark benchmark(out);
+
+    struct Range {
+        Synth::Note lowest;
+        Synth::Note highest;
+    };
+    Range const ranges[] = {
+        {{4, Synth::C}, {4, Synth::B}},
+        {{3, Synth::C}, {5, Synth::B}},
+        {{1, Synth::C}, {7, Synth::B}},
+        {{0, Synth::A}, {8, Synth::C}},
+    };
+    QSize const sizes[] = {{900, 270}, {1920, 400}, {3840, 800}};
+
+    for (auto const& range : ranges) {
+        for (auto const& size : sizes) {
+            benchmark.keyboard(range.lowest, range.highest, size);
+        }
+    }
+    benchmark.mainwindow();
+    return 0;
+}
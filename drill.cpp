@@ -0,0 +1,114 @@
+#include "drill.h"
+#include <cstdlib>
+
+std::vector<Synth::Note> Drill::pool() {
+    std::vector<Synth::Note> notes;
+    for (int octave = LOWEST_OCTAVE; octave <= HIGHEST_OCTAVE; ++octave) {
+        for (int note_class = 0; note_class < Synth::NOTECLASS_AMOUNT; ++note_class) {
+            notes.emplace_back(octave, note_class);
+        }
+    }
+    return notes;
+}
+
+Drill::Drill(NoteSelector & selector, uint64_t seed):
+    selector{selector},
+    random{seed},
+    phase{Phase::ANSWERING},
+    playing{0, 0},
+    prompted_at{0},
+    answered{false},
+    noise_count{0},
+    noise_interval{NOISE_INTERVAL_MS}
+{
+}
+
+void Drill::start(int64_t now) {
+    this->noise_count = 0;
+    this->next = std::nullopt;
+    this->playRandomNote(now);
+}
+
+std::optional<Drill::Guess> Drill::guess(Synth::Note chosen, int64_t now) {
+    if (this->phase != Phase::ANSWERING) return std::nullopt;
+
+    int const difference = chosen.semitone() - this->playing.semitone();
+    Guess const result{
+        this->playing,
+        chosen,
+        difference,
+        std::abs(difference) <= this->settings.confidence,
+        !this->answered,
+        now - this->prompted_at,
+    };
+
+    if (!this->answered) {
+        this->selector.record(this->playing, result.correct);
+        this->answered = true;
+    }
+    if (result.correct) {
+        this->phase = Phase::VICTORY;
+        this->next = now + this->settings.victory_delay_ms;
+    }
+    return result;
+}
+
+void Drill::advance(int64_t now) {
+    // Timers fire at their own deadline, not at now, so a late call doesn't skew the sequence
+    while (this->next && *this->next <= now) {
+        int64_t const t = *this->next;
+        if (this->phase == Phase::VICTORY) {
+            this->changeNote(t);
+        } else if (this->phase == Phase::NOISE) {
+            if (--this->noise_count <= 0) {
+                this->next = std::nullopt;
+            } else {
+                this->next = t + this->noise_interval;
+            }
+            this->playRandomNote(t);
+        } else {
+            this->next = std::nullopt;
+        }
+    }
+}
+
+std::optional<int64_t> Drill::deadline() const {
+    return this->next;
+}
+
+bool Drill::waiting() const {
+    return this->phase == Phase::ANSWERING;
+}
+
+Synth::Note Drill::target() const {
+    return this->playing;
+}
+
+void Drill::changeNote(int64_t now) {
+    if (this->settings.noise) {
+        this->noise_count = NOISE_NOTES;
+        this->noise_interval = NOISE_INTERVAL_MS;
+    } else {
+        this->noise_count = 1;
+        this->noise_interval = 1;
+    }
+    this->phase = Phase::NOISE;
+    this->next = now + this->noise_interval;
+}
+
+void Drill::playRandomNote(int64_t now) {
+    if (this->noise_count > 0) {
+        // Noise before the target stays uniform, only the target adapts to the student
+        std::uniform_int_distribution<int> octave(LOWEST_OCTAVE, HIGHEST_OCTAVE);
+        std::uniform_int_distribution<int> note_class(0, Synth::NOTECLASS_AMOUNT - 1);
+        this->playing = Synth::Note{octave(this->random), note_class(this->random)};
+    } else {
+        this->playing = this->selector.draw(std::uniform_real_distribution<double>(0, 1)(this->random));
+        this->phase = Phase::ANSWERING;
+        this->answered = false;
+    }
+    this->prompted_at = now;
+    if (this->on_play) {
+        this->on_play(this->playing);
+    }
+}
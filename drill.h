@@ -0,0 +1,77 @@
+#ifndef DRILL_H
+#define DRILL_H
+
+#include <functional>
+#include <optional>
+#include <random>
+#include <stdint.h>
+#include "noteselector.h"
+#include "synth.h"
+
+// The ear training game without widgets or timers: play a target, judge guesses within the
+// confidence window, wait out the victory delay and play the noise run into the next target.
+// Time is whatever the caller says it is, in ms; MainWindow drives it from a real clock and
+// the simulation from a virtual one.
+class Drill {
+public:
+    static constexpr int LOWEST_OCTAVE = 3;
+    static constexpr int HIGHEST_OCTAVE = 5;
+    static std::vector<Synth::Note> pool();
+
+    struct Settings {
+        int confidence = 0;
+        bool noise = true;
+        int64_t victory_delay_ms = 0;
+    };
+
+    struct Guess {
+        Synth::Note target;
+        Synth::Note chosen;
+        int difference;
+        bool correct;
+        bool first_attempt;
+        int64_t response_ms;
+    };
+
+    Drill(NoteSelector & selector, uint64_t seed);
+
+    Settings settings;
+    // Called for every note the drill plays, noise included
+    std::function<void(Synth::Note)> on_play;
+
+    void start(int64_t now);
+    // Only counts while a target is waiting for its answer
+    std::optional<Guess> guess(Synth::Note chosen, int64_t now);
+    // Runs every timer that is due at now
+    void advance(int64_t now);
+    // When advance next has work to do, if ever
+    std::optional<int64_t> deadline() const;
+
+    bool waiting() const;
+    Synth::Note target() const;
+
+private:
+    static constexpr int NOISE_NOTES = 10;
+    static constexpr int64_t NOISE_INTERVAL_MS = 500;
+
+    enum class Phase {
+        ANSWERING,
+        VICTORY,
+        NOISE
+    };
+
+    void playRandomNote(int64_t now);
+    void changeNote(int64_t now);
+
+    NoteSelector & selector;
+    std::mt19937_64 random;
+    Phase phase;
+    Synth::Note playing;
+    int64_t prompted_at;
+    bool answered;
+    int noise_count;
+    int64_t noise_interval;
+    std::optional<int64_t> next;
+};
+
+#endif // DRILL_H
@@ -0,0 +1,143 @@
+#include "drillsim.h"
+#include "drill.h"
+#include "noteselector.h"
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace {
+
+struct Student {
+    double accuracy;
+    double weak_accuracy;
+    int weak_class;
+    double latency_ms;
+    double latency_jitter_ms;
+};
+
+struct Totals {
+    int64_t prompts = 0;
+    int64_t guesses = 0;
+    int64_t first_correct = 0;
+    int64_t total_response_ms = 0;
+    int64_t total_solve_ms = 0;
+    int64_t virtual_ms = 0;
+    std::vector<int64_t> targets;
+    std::vector<int64_t> target_misses;
+};
+
+// Guesses the target outright with the student's accuracy, otherwise misses by up to three
+// semitones. Nobody stays stuck: after a dozen misses the answer is given away.
+Synth::Note simulatedGuess(Student const& student, Synth::Note target, int attempt, std::mt19937_64 & random) {
+    double const accuracy = target.note_class == student.weak_class ? student.weak_accuracy : student.accuracy;
+    if (attempt >= 12 || std::bernoulli_distribution(accuracy)(random)) {
+        return target;
+    }
+    int const miss = std::uniform_int_distribution<int>(1, 3)(random) * (std::bernoulli_distribution(0.5)(random) ? 1 : -1);
+    return Synth::Note(target.semitone() + miss);
+}
+
+}
+
+int runDrillSimulation(QStringList const& arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Runs simulated drill sessions without a display.");
+    parser.addHelpOption();
+    QCommandLineOption const sessions_option("simulate", "Number of sessions to run.", "sessions", "1000");
+    QCommandLineOption const prompts_option("prompts", "Target notes per session.", "prompts", "50");
+    QCommandLineOption const accuracy_option("accuracy", "Chance the student names a note right away.", "p", "0.6");
+    QCommandLineOption const weak_class_option("weak-class", "Pitch class (0-11) the student is bad at, -1 for none.", "class", "-1");
+    QCommandLineOption const weak_accuracy_option("weak-accuracy", "Accuracy on the weak pitch class.", "p", "0.2");
+    QCommandLineOption const latency_option("latency", "Mean time to answer in ms.", "ms", "1500");
+    QCommandLineOption const jitter_option("latency-jitter", "Standard deviation of the time to answer in ms.", "ms", "500");
+    QCommandLineOption const confidence_option("confidence", "Semitones a guess may be off.", "semitones", "0");
+    QCommandLineOption const delay_option("delay", "Victory delay in ms.", "ms", "0");
+    QCommandLineOption const no_noise_option("no-noise", "Go straight to the next target without noise notes.");
+    QCommandLineOption const seed_option("seed", "Random seed.", "seed", "1");
+    parser.addOptions({sessions_option, prompts_option, accuracy_option, weak_class_option, weak_accuracy_option,
+                       latency_option, jitter_option, confidence_option, delay_option, no_noise_option, seed_option});
+    parser.process(arguments);
+
+    int const sessions = parser.value(sessions_option).toInt();
+    int const prompts = parser.value(prompts_option).toInt();
+    // bernoulli_distribution needs a probability in [0, 1]
+    Student const student{
+        std::clamp(parser.value(accuracy_option).toDouble(), 0., 1.),
+        std::clamp(parser.value(weak_accuracy_option).toDouble(), 0., 1.),
+        parser.value(weak_class_option).toInt(),
+        parser.value(latency_option).toDouble(),
+        parser.value(jitter_option).toDouble(),
+    };
+    Drill::Settings settings;
+    settings.confidence = parser.value(confidence_option).toInt();
+    settings.noise = !parser.isSet(no_noise_option);
+    settings.victory_delay_ms = parser.value(delay_option).toLongLong();
+
+    std::mt19937_64 random(parser.value(seed_option).toULongLong());
+    // normal_distribution needs a positive deviation, no jitter means a constant latency
+    std::normal_distribution<double> jitter(student.latency_ms, std::max(student.latency_jitter_ms, 1.));
+    auto const latency = [&student, &jitter](std::mt19937_64 & random) {
+        return student.latency_jitter_ms > 0 ? jitter(random) : student.latency_ms;
+    };
+
+    Totals totals;
+    totals.targets.assign(Synth::NOTECLASS_AMOUNT, 0);
+    totals.target_misses.assign(Synth::NOTECLASS_AMOUNT, 0);
+
+    QElapsedTimer wall;
+    wall.start();
+    for (int session = 0; session < sessions; ++session) {
+        NoteSelector selector(Drill::pool());
+        Drill drill(selector, random());
+        drill.settings = settings;
+
+        int64_t now = 0;
+        drill.start(now);
+        for (int prompt = 0; prompt < prompts; ++prompt) {
+            Synth::Note const target = drill.target();
+            int64_t const prompted_at = now;
+            ++totals.targets[target.note_class];
+
+            for (int attempt = 0; drill.waiting(); ++attempt) {
+                now += std::max<int64_t>(100, latency(random));
+                auto const guess = drill.guess(simulatedGuess(student, target, attempt, random), now);
+                ++totals.guesses;
+                totals.total_response_ms += guess->response_ms;
+                if (guess->first_attempt) {
+                    totals.first_correct += guess->correct;
+                    totals.target_misses[target.note_class] += !guess->correct;
+                }
+            }
+            totals.total_solve_ms += now - prompted_at;
+            ++totals.prompts;
+
+            while (!drill.waiting() && drill.deadline()) {
+                now = *drill.deadline();
+                drill.advance(now);
+            }
+        }
+        totals.virtual_ms += now;
+    }
+    double const wall_s = wall.nsecsElapsed() / 1e9;
+
+    QTextStream out(stdout);
+    auto const ratio = [](int64_t a, int64_t b) { return b ? double(a) / b : 0.; };
+    out << "Sessions:              " << sessions << " (" << qRound(sessions / std::max(wall_s, 1e-9)) << "/s, "
+        << QString::number(wall_s, 'f', 2) << " s wall, " << QString::number(totals.virtual_ms / 3.6e6, 'f', 1) << " h simulated)\n";
+    out << "Prompts:               " << totals.prompts << "\n";
+    out << "First-try accuracy:    " << QString::number(100 * ratio(totals.first_correct, totals.prompts), 'f', 1) << "%\n";
+    out << "Guesses per prompt:    " << QString::number(ratio(totals.guesses, totals.prompts), 'f', 2) << "\n";
+    out << "Mean response:         " << QString::number(ratio(totals.total_response_ms, totals.guesses), 'f', 0) << " ms\n";
+    out << "Mean time to solve:    " << QString::number(ratio(totals.total_solve_ms, totals.prompts), 'f', 0) << " ms\n";
+    out << "Per pitch class:       share of targets, first-try miss rate\n";
+    for (int pc = 0; pc < Synth::NOTECLASS_AMOUNT; ++pc) {
+        out << QString("  %1 %2% %3%\n")
+               .arg(Synth::NOTECLASS_NAMES[pc], -3)
+               .arg(100 * ratio(totals.targets[pc], totals.prompts), 6, 'f', 1)
+               .arg(100 * ratio(totals.target_misses[pc], totals.targets[pc]), 6, 'f', 1);
+    }
+    return 0;
+}
@@ -0,0 +1,10 @@
+#ifndef DRILLSIM_H
+#define DRILLSIM_H
+
+#include <QStringList>
+
+// Headless batch mode: simulated students play the drill on a virtual clock and the
+// aggregate outcome is printed. Run as `perfect-pitch --simulate <sessions> [options]`.
+int runDrillSimulation(QStringList const& arguments);
+
+#endif // DRILLSIM_H
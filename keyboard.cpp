@@ -1,104 +1,49 @@
 #include "keyboard.h"
+#include "trace.h"
 #include <QPainter>
 #include <QMouseEvent>
+#include <QPaintEvent>
 #include <QDebug>
 #include <array>
 #include <QTimer>
-
-Keyboard::Keyboard(int octaves, QWidget * parent) : QLabel(parent),
-  octaves{octaves},
-  confidence{0}
+#include <algorithm>
+
+Keyboard::Keyboard(Synth::Note lowest, Synth::Note highest, QWidget * parent) : QWidget(parent),
+  scale{1},
+  // Like a real keyboard, the range starts and ends on a white key
+  lowest{is_black(lowest.semitone()) ? lowest.semitone() - 1 : lowest.semitone()},
+  white_keys{0},
+  confidence{0},
+  hovered{-1, 0}
 {
-    this->setScaledContents(false);
     this->setMinimumSize(parent ? parent->size().width() : 900, 270);
     this->setSizePolicy({QSizePolicy::Expanding, QSizePolicy::Expanding});
-    this->heightForWidth(true);
 
-    QImage background(this->total_local_width(), TOTAL_HEIGHT, QImage::Format_RGB32);
     this->setAttribute(Qt::WA_Hover, true);
 
-    QPainter painter(&background);
-    QBrush stroke_brush(Qt::GlobalColor::black);
-    QPen white_pen(stroke_brush, STROKE_WIDTH);
-    painter.setPen(white_pen);
+    int high = highest.semitone();
+    if (is_black(high)) ++high;
 
-    // Draw the white keys
-    QBrush white_brush(Qt::GlobalColor::white);
-    painter.setBrush(white_brush);
-    float x_offset = 0;
-    for (int i = 0; i < 7; ++i) {
-        QRect rect(x_offset, 0, WIDTH_WHITE_KEY, HEIGHT_WHITE_KEY);
-        this->key_rects[WHITE_KEY_INDICES[i]] = rect;
-        for (int octave = 0; octave < octaves; ++octave) {
-            rect.moveLeft(x_offset + octave*OFFSET);
-            painter.drawRect(rect);
-        }
-        x_offset += WIDTH_WHITE_KEY;
-    }
-
-    // Black keys
-    QBrush black_brush(Qt::GlobalColor::black);
-    painter.setBrush(black_brush);
-    painter.setPen(Qt::PenStyle::NoPen);
-    x_offset = WIDTH_WHITE_KEY - (WIDTH_BLACK_KEY / 2);
-    for (int i = 0; i < 2; ++i) {
-        QRect rect(x_offset, 0, WIDTH_BLACK_KEY, HEIGHT_BLACK_KEY);
-        this->key_rects[BLACK_KEY_INDICES[i]] = rect;
-        for (int octave = 0; octave < octaves; ++octave) {
-            rect.moveLeft(x_offset + OFFSET*octave);
-            painter.drawRect(rect);
-        }
-        x_offset += WIDTH_WHITE_KEY;
-    }
-    x_offset += WIDTH_WHITE_KEY;
-    for (int i = 2; i < 5; ++i) {
-        QRect rect(x_offset, 0, WIDTH_BLACK_KEY, HEIGHT_BLACK_KEY);
-        this->key_rects[BLACK_KEY_INDICES[i]] = rect;
-        for (int octave = 0; octave < octaves; ++octave) {
-            rect.moveLeft(x_offset + OFFSET*octave);
-            painter.drawRect(rect);
+    // Black keys straddle the boundary between the two white keys around them
+    for (int semitone = this->lowest; semitone <= high; ++semitone) {
+        qreal const x_offset = this->white_keys * WIDTH_WHITE_KEY;
+        if (is_black(semitone)) {
+            this->key_rects.push_back(QRect(x_offset - (WIDTH_BLACK_KEY / 2), 0, WIDTH_BLACK_KEY, HEIGHT_BLACK_KEY));
+        } else {
+            this->key_rects.push_back(QRect(x_offset, 0, WIDTH_WHITE_KEY, HEIGHT_WHITE_KEY));
+            ++this->white_keys;
         }
-        x_offset += WIDTH_WHITE_KEY;
     }
 
-    QPixmap pix;
-    pix.convertFromImage(background);
-    this->layers[LayerId::BACKGROUND].pixels = pix;
-    this->layers[LayerId::BACKGROUND].mask = {pix.rect()};
-    this->layers[LayerId::BACKGROUND].composition_mode = QPainter::CompositionMode_Source;
-
-    this->layers[LayerId::HOVER].mask = QRegion();
-    this->layers[LayerId::HOVER].pixels = pix;
-    this->layers[LayerId::HOVER].pixels.fill(QColor::fromRgb(0, 0, 255));
-    this->layers[LayerId::HOVER].composition_mode = QPainter::CompositionMode_Source;
-
-    this->layers[LayerId::CORRECT].pixels = pix;
-    this->layers[LayerId::CORRECT].pixels.fill(QColor::fromRgb(0, 255, 0));
-    this->layers[LayerId::CORRECT].mask = QRegion();
-    this->layers[LayerId::CORRECT].composition_mode = QPainter::CompositionMode_Source;
-    this->composite = pix;
-
-    this->compose(this->size());
+    this->layers[LayerId::HOVER].brush = QBrush(QColor::fromRgb(0, 0, 255));
+    this->layers[LayerId::CORRECT].brush = QBrush(QColor::fromRgb(0, 255, 0));
 
+    // Nothing is rendered until the first resizeEvent lays the keyboard out at its real size
 
     this->flickerState = false;
     this->flickerTimer.setInterval(100);
     this->flickerTimer.setSingleShot(false);
-    connect(&this->flickerTimer, &QTimer::timeout, this, [this]() {
-        this->flickerState = !this->flickerState;
-
-        if (this->disable_flicker.isActive() && this->flickerState) {
-            int const gpci = std::get<0>(this->correct)*12 + std::get<1>(this->correct);
-            this->layers[LayerId::CORRECT].mask = this->range_region(gpci, gpci);
-        } else {
-            this->layers[LayerId::CORRECT].mask = QRegion();
-        }
-        this->compose(this->size());
-
-        if (!this->disable_flicker.isActive()) {
-            this->flickerTimer.stop();
-        }
-    });
+    connect(&this->flickerTimer, &QTimer::timeout, this, &Keyboard::flicker);
     this->flickerTimer.start();
 
     this->disable_flicker.setInterval(2000);
@@ -106,135 +51,247 @@ Keyboard::Keyboard(int octaves, QWidget * parent) : QLabel(parent),
     connect(&this->disable_flicker, &QTimer::timeout, this, [this]() { });
 }
 
-void Keyboard::flicker_correct(int octave, Synth::PitchClass p) {
-    this->correct = {octave, p};
+void Keyboard::flicker_correct(Synth::Note note) {
+    this->correct = note;
     this->flickerState = true;
     this->disable_flicker.start();
     this->flickerTimer.start();
-    this->compose(this->size());
+    this->set_mask(LayerId::CORRECT, this->correct_region());
 }
 
-void Keyboard::compose(QSize const size) {
-    QPainter p(&this->composite);
-    for (size_t i = 0; i < this->layers.size(); ++i) {
-        auto const& layer = this->layers[i];
-        p.setCompositionMode(layer.composition_mode);
-        p.setClipRegion(layer.mask);
-        p.fillRect(this->composite.rect(), layer.pixels);
+void Keyboard::flicker() {
+    TRACE_SCOPE("Keyboard::flicker");
+    this->flickerState = !this->flickerState;
+
+    this->set_mask(LayerId::CORRECT, this->correct_region());
+
+    if (!this->disable_flicker.isActive()) {
+        this->flickerTimer.stop();
     }
-    p.end();
+}
 
-    QPixmap px = this->composite.scaled(size, Qt::KeepAspectRatio);
-    this->scale = static_cast<qreal>(px.width()) / this->total_local_width();
-    this->setPixmap(px);
+QRegion Keyboard::correct_region() const {
+    if (this->disable_flicker.isActive() && this->flickerState) {
+        int const key = this->correct.semitone() - this->lowest;
+        return this->range_region(key, key);
+    }
+    return QRegion();
 }
 
-std::tuple<int, size_t> Keyboard::key_from_pos(QPoint const& p) const {
-    qreal const yoffset = (this->size().height() - this->pixmap(Qt::ReturnByValueConstant{}).size().height()) / 2;
-    qreal const y = (p.y() - yoffset) / this->scale;
+void Keyboard::set_mask(LayerId id, QRegion const& mask) {
+    // Only the keys that changed state get repainted
+    QRegion const changed = this->layers[id].mask.xored(mask);
+    this->layers[id].mask = mask;
+    if (!changed.isEmpty()) {
+        this->update(changed);
+    }
+}
 
-    qreal const xt = p.x() / this->scale;
-    int const octave = xt / OFFSET;
-    qreal const x = xt - octave*OFFSET;
+void Keyboard::relayout(QSize const size) {
+    this->scale = std::min(size.width() / qreal(this->total_local_width()), size.height() / TOTAL_HEIGHT);
+    int const width = qRound(this->total_local_width() * this->scale);
+    int const height = qRound(TOTAL_HEIGHT * this->scale);
+    this->target = QRect(0, (size.height() - height) / 2, width, height);
+
+    qreal const dpr = this->devicePixelRatioF();
+    this->background = QPixmap(this->target.size() * dpr);
+    this->background.setDevicePixelRatio(dpr);
+    QPainter painter(&this->background);
+    painter.scale(this->scale, this->scale);
+    this->paint_background(painter);
+    painter.end();
+
+    this->build_key_regions();
+    this->build_hit_tables();
+    this->layers[LayerId::HOVER].mask = QRegion();
+    this->layers[LayerId::CORRECT].mask = this->correct_region();
+    this->hovered = {-1, this->confidence};
+    if (this->last_hover_pos) {
+        int const key = this->key_from_pos(*this->last_hover_pos);
+        if (key != -1) {
+            this->hover(key);
+        }
+    }
+}
+
+void Keyboard::paint_background(QPainter & painter) const {
+    QBrush stroke_brush(Qt::GlobalColor::black);
+    QPen white_pen(stroke_brush, STROKE_WIDTH);
+    painter.setPen(white_pen);
 
-    std::array<bool, 12> matches;
-    matches.fill(false);
+    // Draw the white keys
+    QBrush white_brush(Qt::GlobalColor::white);
+    painter.setBrush(white_brush);
+    for (size_t key = 0; key < this->key_rects.size(); ++key) {
+        if (!is_black(this->lowest + key)) {
+            painter.drawRect(this->key_rects[key]);
+        }
+    }
 
-    for (size_t i = 0; i < this->key_rects.size(); ++i) {
-        auto key_rect = this->key_rects[i];
-        key_rect.setHeight(key_rect.height() + STROKE_WIDTH);
-        if (key_rect.contains(x, y)) {
-            matches[i] = true;
+    // Black keys
+    QBrush black_brush(Qt::GlobalColor::black);
+    painter.setBrush(black_brush);
+    painter.setPen(Qt::PenStyle::NoPen);
+    for (size_t key = 0; key < this->key_rects.size(); ++key) {
+        if (is_black(this->lowest + key)) {
+            painter.drawRect(this->key_rects[key]);
         }
     }
+}
+
+void Keyboard::compose(QPainter & p, QRegion const& exposed) const {
+    TRACE_SCOPE("Keyboard::compose");
+    p.setClipRegion(exposed);
+    p.drawPixmap(this->target.topLeft(), this->background);
+    for (auto const& layer : this->layers) {
+        QRegion const clip = layer.mask.intersected(exposed);
+        if (clip.isEmpty()) continue;
+        p.setClipRegion(clip);
+        p.fillRect(this->target, layer.brush);
+    }
+}
 
-    for (auto const i : BLACK_KEY_INDICES) {
-        if (matches[i]) {
-            Synth::PitchClass note_class = static_cast<Synth::PitchClass>(i);
-            return {octave, note_class};
+void Keyboard::paintEvent(QPaintEvent * const e) {
+    if (!qFuzzyCompare(this->background.devicePixelRatioF(), this->devicePixelRatioF())) {
+        this->relayout(this->size());
+    }
+    QPainter p(this);
+    this->compose(p, e->region());
+}
+
+void Keyboard::build_hit_tables() {
+    // Matches a rect test in local coordinates: those are truncated and each key extends one
+    // stroke below its rect. Black keys win over the white key beneath them.
+    int const local_width = this->total_local_width();
+    std::vector<qint16> white_at(local_width, -1);
+    std::vector<qint16> black_at(local_width, -1);
+    for (size_t key = 0; key < this->key_rects.size(); ++key) {
+        QRect const& key_rect = this->key_rects[key];
+        auto & table = is_black(this->lowest + key) ? black_at : white_at;
+        for (int x = std::max(key_rect.left(), 0); x <= std::min(key_rect.right(), local_width - 1); ++x) {
+            table[x] = key;
         }
     }
-    for (auto const i : WHITE_KEY_INDICES) {
-        if (matches[i]) {
-            Synth::PitchClass note_class = static_cast<Synth::PitchClass>(i);
-            return {octave, note_class};
+
+    this->white_columns.assign(this->target.width(), -1);
+    this->black_columns.assign(this->target.width(), -1);
+    for (int column = 0; column < this->target.width(); ++column) {
+        int const x = column / this->scale;
+        if (x < local_width) {
+            this->white_columns[column] = white_at[x];
+            this->black_columns[column] = black_at[x];
         }
     }
-    return {-1, 0};
+
+    this->black_rows.resize(this->target.height());
+    for (int row = 0; row < this->target.height(); ++row) {
+        int const y = row / this->scale;
+        this->black_rows[row] = y <= HEIGHT_BLACK_KEY;
+    }
+}
+
+int Keyboard::key_from_pos(QPoint const& p) const {
+    int const column = p.x() - this->target.x();
+    int const row = p.y() - this->target.y();
+    if (column < 0 || row < 0 || column >= this->target.width() || row >= this->target.height()) {
+        return -1;
+    }
+
+    if (this->black_rows[row] && this->black_columns[column] != -1) {
+        return this->black_columns[column];
+    }
+    return this->white_columns[column];
 }
 
 void Keyboard::mouseReleaseEvent(QMouseEvent *ev) {
-    auto const& [octave, pitch_class] = this->key_from_pos(ev->pos());
-    if (octave != -1) {
-        emit pressed(octave, static_cast<Synth::PitchClass>(pitch_class));
+    int const key = this->key_from_pos(ev->pos());
+    if (key != -1) {
+        emit pressed(Synth::Note(this->lowest + key));
     }
 }
 
 void Keyboard::hoverEnter(QHoverEvent * e) {
-    this->last_hover_event = *e;
+    this->last_hover_pos = e->pos();
 };
 
-void Keyboard::hoverLeave(QHoverEvent * e) {
-    this->layers[LayerId::HOVER].mask = QRegion();
-    this->compose(this->size());
-    this->last_hover_event = std::nullopt;
+void Keyboard::hoverLeave(QHoverEvent *) {
+    this->set_mask(LayerId::HOVER, QRegion());
+    this->hovered = {-1, this->confidence};
+    this->last_hover_pos = std::nullopt;
 }
 
 
-QRegion Keyboard::range_region(int low, int high) const {
-    QRegion mask;
-    for (int pc : WHITE_KEY_INDICES) {
-        for (int local_octave = 0; local_octave < this->octaves; ++local_octave) {
-            int const i = pc + local_octave * 12;
-            if (i >= low && i <= high) {
-                QRect key_rect = key_rects[pc];
-                key_rect.moveLeft(key_rect.left() + local_octave*OFFSET + STROKE_WIDTH);
-                key_rect.moveTop(key_rect.top() + STROKE_WIDTH);
-                key_rect.setWidth(key_rect.width() - STROKE_WIDTH);
-                key_rect.setHeight(key_rect.height() - STROKE_WIDTH);
-                mask = mask.united(key_rect);
-            }
+void Keyboard::build_key_regions() {
+    QTransform const to_widget = QTransform::fromTranslate(this->target.x(), this->target.y()).scale(this->scale, this->scale);
+
+    QRegion black_keys;
+    for (size_t key = 0; key < this->key_rects.size(); ++key) {
+        if (is_black(this->lowest + key)) {
+            black_keys = black_keys.united(this->key_rects[key]);
         }
     }
 
-    for (int pc : BLACK_KEY_INDICES) {
-        for (int local_octave = 0; local_octave < this->octaves; ++local_octave) {
-            QRect key_rect = key_rects[pc];
-            key_rect.moveLeft(key_rect.left() + local_octave*OFFSET);
-            mask = mask.subtracted(key_rect);
+    this->key_regions.assign(this->key_rects.size(), QRegion());
+    for (size_t key = 0; key < this->key_rects.size(); ++key) {
+        QRect key_rect = this->key_rects[key];
+        key_rect.moveLeft(key_rect.left() + STROKE_WIDTH);
+        key_rect.moveTop(key_rect.top() + STROKE_WIDTH);
+        if (is_black(this->lowest + key)) {
+            key_rect.setWidth(key_rect.width() - 2*STROKE_WIDTH);
+            key_rect.setHeight(key_rect.height() - 2*STROKE_WIDTH);
+            this->key_regions[key] = to_widget.map(QRegion(key_rect));
+        } else {
+            key_rect.setWidth(key_rect.width() - STROKE_WIDTH);
+            key_rect.setHeight(key_rect.height() - STROKE_WIDTH);
+            this->key_regions[key] = to_widget.map(QRegion(key_rect).subtracted(black_keys));
         }
     }
 
-    for (int pc : BLACK_KEY_INDICES) {
-        for (int local_octave = 0; local_octave < this->octaves; ++local_octave) {
-            int const i = pc + local_octave * 12;
-            if (i >= low && i <= high) {
-                QRect key_rect = key_rects[pc];
-                key_rect.moveLeft(key_rect.left() + local_octave*OFFSET + STROKE_WIDTH);
-                key_rect.moveTop(key_rect.top() + STROKE_WIDTH);
-                key_rect.setWidth(key_rect.width() - 2*STROKE_WIDTH);
-                key_rect.setHeight(key_rect.height() - 2*STROKE_WIDTH);
-                mask = mask.united(key_rect);
-            }
-        }
+    this->range_cache.clear();
+}
+
+QRegion Keyboard::range_region(int low, int high) const {
+    low = std::max(low, 0);
+    high = std::min(high, static_cast<int>(this->key_regions.size()) - 1);
+    if (low > high) {
+        return QRegion();
     }
+
+    auto const cached = this->range_cache.constFind({low, high});
+    if (cached != this->range_cache.cend()) {
+        return *cached;
+    }
+
+    QRegion mask;
+    for (int i = low; i <= high; ++i) {
+        mask += this->key_regions[i];
+    }
+    this->range_cache.insert({low, high}, mask);
     return mask;
 }
 
 void Keyboard::hoverMove(QHoverEvent * ev) {
-    auto const& [octave, pitch_class] = this->key_from_pos(ev->pos());
+    TRACE_SCOPE("Keyboard::hoverMove");
+    int const key = this->key_from_pos(ev->pos());
 
-    if (octave == -1) {
-        this->hoverLeave(ev);
+    if (key == -1) {
+        if (this->last_hover_pos) {
+            this->hoverLeave(ev);
+        }
         return;
     }
 
-    int const pci = static_cast<int>(pitch_class);
-    int const gpci = octave * 12 + pci;
+    this->last_hover_pos = ev->pos();
+    this->hover(key);
+}
+
+void Keyboard::hover(int key) {
+    // Pointer motion within the same key at the same confidence changes nothing
+    std::pair<int, int> const hovered{key, this->confidence};
+    if (hovered == this->hovered) return;
+    this->hovered = hovered;
 
-    this->layers[LayerId::HOVER].mask = this->range_region(gpci - this->confidence, gpci + this->confidence);
-    this->compose(this->size());
-    this->last_hover_event = *ev;
+    this->set_mask(LayerId::HOVER, this->range_region(key - this->confidence, key + this->confidence));
 }
 
 bool Keyboard::event(QEvent * e) {
@@ -260,8 +317,11 @@ bool Keyboard::event(QEvent * e) {
 
 void Keyboard::change_confidence(int cf) {
     this->confidence = cf;
-    if (this->last_hover_event) {
-        this->hoverMove(&this->last_hover_event.value());
+    if (this->last_hover_pos) {
+        int const key = this->key_from_pos(*this->last_hover_pos);
+        if (key != -1) {
+            this->hover(key);
+        }
     }
 }
 
@@ -271,8 +331,9 @@ void Keyboard::set_correct_duration(double s) {
 }
 
 void Keyboard::resizeEvent(QResizeEvent * const e) {
-    QLabel::resizeEvent(e);
-    this->compose(e->size());
+    QWidget::resizeEvent(e);
+    this->relayout(e->size());
+    this->update();
 }
 
 QSize Keyboard::sizeHint() const {
@@ -284,7 +345,12 @@ int Keyboard::heightForWidth(int w) const {
 }
 
 int Keyboard::total_local_width() const {
-    return this->octaves * Keyboard::OFFSET + STROKE_WIDTH;
+    return this->white_keys * WIDTH_WHITE_KEY + STROKE_WIDTH;
+}
+
+bool Keyboard::is_black(int semitone) {
+    int const pc = semitone % Synth::NOTECLASS_AMOUNT;
+    return std::find(BLACK_KEY_INDICES.begin(), BLACK_KEY_INDICES.end(), pc) != BLACK_KEY_INDICES.end();
 }
 
 int Keyboard::aspect_ratio() const {
@@ -1,28 +1,30 @@
 #ifndef KEYBOARD_H
 #define KEYBOARD_H
 
-#include <QLabel>
+#include <QWidget>
 #include <QPainter>
 #include <QTimer>
 #include <array>
 #include <optional>
+#include <vector>
+#include <QHash>
 #include <QHoverEvent>
 #include "synth.h"
 
-class Keyboard : public QLabel
+class Keyboard : public QWidget
 {
     Q_OBJECT
+    friend class KeyboardBenchmark;
 public:
-    Keyboard(int octaves = 1, QWidget * parent = nullptr);
+    // Any range up to a full piano (A0 to C8); black key bounds are widened to the next white key
+    Keyboard(Synth::Note lowest, Synth::Note highest, QWidget * parent = nullptr);
 
 signals:
-    void pressed(int octave, Synth::PitchClass);
+    void pressed(Synth::Note);
 public slots:
     void change_confidence(int);
-    void flicker_correct(int octave, Synth::PitchClass);
+    void flicker_correct(Synth::Note);
     void set_correct_duration(double s);
-private slots:
-    void compose(QSize const);
 private:
     static constexpr qreal WIDTH_WHITE_KEY = 10;
     static constexpr qreal HEIGHT_WHITE_KEY = 50;
@@ -30,49 +32,75 @@ private:
     static constexpr qreal HEIGHT_BLACK_KEY = 30;
     static constexpr qreal STROKE_WIDTH = 1;
     static constexpr qreal TOTAL_HEIGHT = HEIGHT_WHITE_KEY + STROKE_WIDTH;
-    static constexpr qreal OFFSET = WIDTH_WHITE_KEY*7;
-    static constexpr qreal WIDTH = OFFSET + STROKE_WIDTH;
-    static constexpr std::array<int, 7> WHITE_KEY_INDICES = {0, 2, 4, 5, 7, 9, 11};
     static constexpr std::array<int, 5> BLACK_KEY_INDICES = {1, 3, 6, 8, 10};
+    static bool is_black(int semitone);
     qreal scale;
-    int octaves;
 
     int aspect_ratio() const;
     int total_local_width() const;
 
-    std::array<QRect, 12> key_rects;
+    // Keys are numbered from 0 at the lowest one, which sits at this semitone (octave * 12 + pitch class)
+    int lowest;
+    int white_keys;
+    std::vector<QRect> key_rects;
 
+    // Where the keyboard lands inside the widget, and the keys rendered at that size and
+    // the screen's device pixel ratio. Rebuilt on resize only.
+    QRect target;
+    QPixmap background;
+    void relayout(QSize const);
+    void paint_background(QPainter &) const;
+
+    // Overlays are solid fills clipped to a mask in widget coordinates
     struct Layer {
-        QPixmap pixels;
+        QBrush brush;
         QRegion mask;
-        QPainter::CompositionMode composition_mode;
     };
 
     enum LayerId {
-        BACKGROUND,
         HOVER,
         CORRECT
     };
 
-    std::array<Layer, 3> layers;
-    QPixmap composite;
+    std::array<Layer, 2> layers;
+    void set_mask(LayerId, QRegion const&);
+    QRegion correct_region() const;
+    void compose(QPainter &, QRegion const& exposed) const;
 
     int confidence;
-    std::tuple<int, size_t> key_from_pos(QPoint const&) const;
+
+    // Hit testing: the key (or -1) under each column of the
+    // target rect, and whether a row reaches the black keys. Rebuilt once per layout.
+    std::vector<qint16> white_columns;
+    std::vector<qint16> black_columns;
+    std::vector<bool> black_rows;
+    void build_hit_tables();
+    int key_from_pos(QPoint const&) const;
+
     void mouseReleaseEvent(QMouseEvent *ev) override;
 
     void hoverEnter(QHoverEvent * event);
     void hoverLeave(QHoverEvent * event);
     void hoverMove(QHoverEvent * event);
+    void hover(int key);
+    std::pair<int, int> hovered;
     bool event(QEvent * e) override;
     void resizeEvent(QResizeEvent*) override;
+    void paintEvent(QPaintEvent*) override;
     QRegion range_region(int low, int high) const;
 
+    // Region of every key in widget coordinates.
+    // Rebuilt once per layout; ranges are composed from these and memoized per (low, high).
+    std::vector<QRegion> key_regions;
+    mutable QHash<QPair<int, int>, QRegion> range_cache;
+    void build_key_regions();
+
     bool flickerState;
     QTimer flickerTimer;
-    std::optional<QHoverEvent> last_hover_event;
+    void flicker();
+    std::optional<QPoint> last_hover_pos;
 
-    std::tuple<int, Synth::PitchClass> correct;
+    Synth::Note correct;
     QTimer disable_flicker;
 
     QSize sizeHint() const override;
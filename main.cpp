@@ -1,11 +1,34 @@
 #include "mainwindow.h"
+#include "drillsim.h"
+#include "trace.h"
 
 #include <QApplication>
+#include <QElapsedTimer>
 
 int main(int argc, char *argv[])
 {
+    QElapsedTimer startup;
+    startup.start();
+
+    // Batch mode never touches a display
+    for (int i = 1; i < argc; ++i) {
+        if (QByteArray(argv[i]).startsWith("--simulate")) {
+            QCoreApplication a(argc, argv);
+            return runDrillSimulation(a.arguments());
+        }
+    }
+
+    // PERFECT_PITCH_TRACE=<file.json> traces the whole run and writes it out on exit
+    QString const trace_path = qEnvironmentVariable("PERFECT_PITCH_TRACE");
+    Trace::setEnabled(!trace_path.isEmpty());
+
     QApplication a(argc, argv);
-    MainWindow w;
+    MainWindow w(startup);
     w.show();
-    return a.exec();
+    int const result = a.exec();
+
+    if (!trace_path.isEmpty()) {
+        Trace::dump(trace_path);
+    }
+    return result;
 }
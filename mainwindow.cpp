@@ -4,94 +4,165 @@
 #include <QRandomGenerator>
 #include <QDebug>
 #include <QTimer>
+#include <QDir>
+#include <QStandardPaths>
+#include <QDateTime>
+#include <algorithm>
 #include "keyboard.h"
+#include "trace.h"
 
-MainWindow::MainWindow(QWidget *parent)
+MainWindow::MainWindow(QElapsedTimer const& startup, QWidget *parent)
     : QMainWindow(parent),
       playing{0, 0}
     , ui(new Ui::MainWindow)
+    , startup{startup}
 {
     ui->setupUi(this);
 
+    // Open the audio device on the synth thread so the first frame doesn't wait for it
+    this->synthThread.setObjectName("synth");
     synth.moveToThread(&this->synthThread);
+    connect(&this->synthThread, &QThread::started, &this->synth, &Synth::start);
+    connect(&this->synth, &Synth::audioReady, this, &MainWindow::audioReady);
+
+    // PERFECT_PITCH_LATENCY_MS and PERFECT_PITCH_MAX_UNDERRUNS (per minute) tune the audio
+    // buffer for machines the defaults don't suit. The synth thread isn't running yet, so
+    // these can be set directly.
+    bool ok = false;
+    int const latency_ms = qEnvironmentVariableIntValue("PERFECT_PITCH_LATENCY_MS", &ok);
+    if (ok && latency_ms > 0) {
+        this->synth.setLatencyTarget(latency_ms);
+    }
+    double const max_underruns = qEnvironmentVariable("PERFECT_PITCH_MAX_UNDERRUNS").toDouble(&ok);
+    if (ok && max_underruns > 0) {
+        this->synth.setMaxUnderrunRate(max_underruns);
+    }
     this->synthThread.start();
 
-    this->synth.start();
-
     auto * const vlayout =  static_cast<QVBoxLayout*>(this->ui->centralwidget->layout());
-    this->kb = new Keyboard(3, this);
-    connect(this->kb, &Keyboard::pressed, this, [this](int octave, Synth::PitchClass note_class) {
-        this->notePressed({octave + 3, note_class});
-    });
+    this->kb = new Keyboard({3, Synth::C}, {5, Synth::B}, this);
+    connect(this->kb, &Keyboard::pressed, this, &MainWindow::notePressed);
     vlayout->setStretch(0, 1);
     vlayout->addWidget(kb, 4);
 
     QObject::connect(this->ui->confidence, QOverload<int>::of(&QSpinBox::valueChanged), kb, &Keyboard::change_confidence);
 
-    this->installEventFilter(this);
-    this->playRandomNote();
-
-    connect(this->ui->volumeSlider, &QSlider::valueChanged, this, &MainWindow::volumeChanged);
+    QString const data_dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(data_dir);
+    this->log = std::make_unique<SessionLog>(QDir(data_dir).filePath("session.log"));
 
-    this->noise_timer.setInterval(500);
-    this->noise_timer.setSingleShot(false);
-    QObject::connect(&this->noise_timer, &QTimer::timeout, this, [this](){
-        if (--this->noise_count <= 0) {
-            this->noise_timer.stop();
+    this->selector = std::make_unique<NoteSelector>(Drill::pool());
+    for (Synth::Note const note : this->selector->notes()) {
+        SessionLog::NoteSummary const& summary = this->log->summary(note);
+        if (summary.first_attempts > 0) {
+            this->selector->seed(note, 1 - summary.first_try_accuracy());
         }
-        this->playRandomNote();
-    });
+    }
 
-    this->delay_timer.setInterval(0);
-    this->delay_timer.setSingleShot(true);
+    this->drill = std::make_unique<Drill>(*this->selector, QRandomGenerator::global()->generate64());
+    this->drill->settings.confidence = this->ui->confidence->value();
+    this->drill->settings.noise = this->ui->noise->isChecked();
+    this->drill->settings.victory_delay_ms = this->ui->victoryDelay->value() * 1000;
+    this->drill->on_play = [this](Synth::Note note) {
+        this->sendToSynth("Synth::playNote", [this, note]() { this->synth.playNote(note); });
+        qDebug() << "Playing Note=" << note;
+    };
+    connect(this->ui->confidence, QOverload<int>::of(&QSpinBox::valueChanged), this, [this](int v) {
+        this->drill->settings.confidence = v;
+    });
+    connect(this->ui->noise, &QCheckBox::toggled, this, [this](bool checked) {
+        this->drill->settings.noise = checked;
+    });
     connect(this->ui->victoryDelay, QOverload<double>::of(&QDoubleSpinBox::valueChanged), this, [this](double v) {
-        this->delay_timer.setInterval(v * 1000);
+        this->drill->settings.victory_delay_ms = v * 1000;
     });
     connect(this->ui->victoryDelay, QOverload<double>::of(&QDoubleSpinBox::valueChanged), this->kb, &Keyboard::set_correct_duration);
-    connect(&this->delay_timer, &QTimer::timeout, this, &MainWindow::changeNote);
+
+    this->drill_timer.setSingleShot(true);
+    connect(&this->drill_timer, &QTimer::timeout, this, [this]() {
+        TRACE_SCOPE("MainWindow::drillTimer");
+        this->drill->advance(this->drill_clock.elapsed());
+        this->scheduleDrill();
+    });
+
+    this->installEventFilter(this);
+    this->drill_clock.start();
+    {
+        TRACE_SCOPE("Drill::start");
+        this->drill->start(this->drill_clock.elapsed());
+    }
+
+    connect(this->ui->volumeSlider, &QSlider::valueChanged, this, &MainWindow::volumeChanged);
 }
 
 void MainWindow::volumeChanged(int v) {
     double const volume = QAudio::convertVolume(v / qreal(100), QAudio::LogarithmicVolumeScale, QAudio::LinearVolumeScale);
-    this->synth.changeVolume(volume);
+    this->sendToSynth("Synth::changeVolume", [this, volume]() { this->synth.changeVolume(volume); });
+}
+
+void MainWindow::sendToSynth(char const * name, std::function<void()> call) {
+    // Both ends of a flow have to sit inside a slice or trace viewers drop the arrow
+    TRACE_SCOPE("MainWindow::sendToSynth");
+    uint64_t const flow = Trace::flowId();
+    Trace::flowStart(name, flow);
+    QMetaObject::invokeMethod(&this->synth, [name, flow, call = std::move(call)]() {
+        Trace::Scope const scope(name);
+        Trace::flowEnd(name, flow);
+        call();
+    }, Qt::QueuedConnection);
+}
+
+void MainWindow::audioReady(bool ok) {
+    if (ok) {
+        this->audio_ready_ms = this->startup.elapsed();
+    } else {
+        qWarning() << "Audio output failed to start";
+        this->audio_failed_ms = this->startup.elapsed();
+    }
+    this->reportStartup();
+}
+
+void MainWindow::reportStartup() const {
+    if (!this->first_paint_ms) return;
+    if (this->audio_ready_ms) {
+        qDebug() << "Startup: first paint after" << *this->first_paint_ms << "ms, audio ready after" << *this->audio_ready_ms << "ms";
+    } else if (this->audio_failed_ms) {
+        qDebug() << "Startup: first paint after" << *this->first_paint_ms << "ms, audio failed after" << *this->audio_failed_ms << "ms";
+    }
 }
 
 MainWindow::~MainWindow()
 {
-    this->synth.stop();
+    QMetaObject::invokeMethod(&this->synth, &Synth::stop, Qt::BlockingQueuedConnection);
     this->synthThread.exit();
     this->synthThread.wait();
     delete ui;
 }
 
-void MainWindow::changeNote() {
-    if (this->ui->noise->isChecked()) {
-        this->noise_count = 10;
-        this->noise_timer.setInterval(500);
-    } else {
-        this->noise_count = 1;
-        this->noise_timer.setInterval(1);
+void MainWindow::scheduleDrill() {
+    if (auto const deadline = this->drill->deadline()) {
+        this->drill_timer.start(std::max<qint64>(0, *deadline - this->drill_clock.elapsed()));
     }
-    this->noise_timer.start();
-}
-
-void MainWindow::playRandomNote() {
-    QRandomGenerator * const random = QRandomGenerator::global();
-    this->playing = Synth::Note{random->bounded(3, 6), random->bounded(0, Synth::NOTECLASS_AMOUNT)};
-    this->synth.playNote(this->playing);
-    qDebug() << "Playing Note=" << this->playing;
 }
 
 void MainWindow::notePressed(Synth::Note const chosen) {
-    int const confidence = this->ui->confidence->value();
-    int const difference = (chosen.octave - this->playing.octave)*12 + (chosen.note_class - this->playing.note_class);
-
-    if (std::abs(difference) <= confidence) {
-        this->ui->statusbar->showMessage(QString("Correct: %1. Guess: %2. Off by %3").arg(this->playing).arg(chosen).arg(difference));
-        this->kb->flicker_correct(this->playing.octave - 3, this->playing.note_class);
-        this->delay_timer.start();
+    auto const guess = this->drill->guess(chosen, this->drill_clock.elapsed());
+    if (!guess) return;
+    this->log->append(guess->target, chosen, this->drill->settings.confidence, guess->response_ms, guess->first_attempt);
+
+    SessionLog::NoteSummary const& summary = this->log->summary(guess->target);
+    QString const history = QString(" (%1: %2% of %3, %4 s)")
+            .arg(guess->target)
+            .arg(qRound(summary.accuracy() * 100))
+            .arg(summary.attempts)
+            .arg(summary.mean_response_ms() / 1000, 0, 'f', 1);
+
+    if (guess->correct) {
+        this->ui->statusbar->showMessage(QString("Correct: %1. Guess: %2. Off by %3").arg(guess->target).arg(chosen).arg(guess->difference) + history);
+        this->kb->flicker_correct(guess->target);
+        this->scheduleDrill();
     } else {
-        this->ui->statusbar->showMessage("Wrong");
+        this->ui->statusbar->showMessage("Wrong" + history);
     }
 }
 
@@ -121,10 +192,10 @@ void MainWindow::onKey(int key, int direction) {
         bool const alreadyPlaying = this->playing == fullNote;
         if (direction == KeyCapturer::PRESS && !alreadyPlaying) {
             this->playing = fullNote;
-            this->synth.playNote(fullNote);
+            this->sendToSynth("Synth::playNote", [this, fullNote]() { this->synth.playNote(fullNote); });
         } else if (alreadyPlaying) {
             this->playing = {0, 0};
-            this->synth.stopNote();
+            this->sendToSynth("Synth::stopNote", [this]() { this->synth.stopNote(); });
         }
     }
 }
@@ -133,6 +204,24 @@ bool MainWindow::eventFilter(QObject *obj, QEvent *event) {
     QKeyEvent *keyEvent = NULL;
     bool result = false;
 
+    if (obj == this && event->type() == QEvent::Paint && !this->first_paint_ms) {
+        this->first_paint_ms = this->startup.elapsed();
+        this->reportStartup();
+    }
+
+    // Only on the real key press, a ShortcutOverride precedes it
+    if (event->type() == QEvent::KeyPress) {
+        auto const * const trace_key = static_cast<QKeyEvent*>(event);
+        if (!trace_key->isAutoRepeat() && trace_key->key() == Qt::Key_F11) {
+            Trace::setEnabled(!Trace::enabled());
+            this->ui->statusbar->showMessage(Trace::enabled() ? "Tracing on" : "Tracing off");
+            return true;
+        }
+        if (!trace_key->isAutoRepeat() && trace_key->key() == Qt::Key_F12) {
+            this->dumpTrace();
+            return true;
+        }
+    }
 
     if (event->type() == QEvent::KeyPress || event->type() == QEvent::ShortcutOverride) {
          keyEvent = dynamic_cast<QKeyEvent*>(event);
@@ -151,6 +240,15 @@ bool MainWindow::eventFilter(QObject *obj, QEvent *event) {
     return result;
 }
 
+void MainWindow::dumpTrace() {
+    QString const dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(dir);
+    QString const path = QDir(dir).filePath(QString("trace-%1.json").arg(QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss")));
+    if (Trace::dump(path)) {
+        this->ui->statusbar->showMessage("Trace written to " + path);
+    }
+}
+
 void MainWindow::wheelEvent(QWheelEvent * const e) {
     int const delta = e->angleDelta().y() / 120;
     this->ui->confidence->setValue(this->ui->confidence->value() + delta);
@@ -5,7 +5,14 @@
 #include <synth.h>
 #include <QThread>
 #include <QKeyEvent>
+#include <QElapsedTimer>
+#include <optional>
 #include "keyboard.h"
+#include "sessionlog.h"
+#include "noteselector.h"
+#include "drill.h"
+#include <functional>
+#include <memory>
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -26,26 +33,44 @@ class MainWindow : public QMainWindow
     Q_OBJECT
 
 public:
-    MainWindow(QWidget *parent = nullptr);
+    MainWindow(QElapsedTimer const& startup, QWidget *parent = nullptr);
     ~MainWindow();
 
 private slots:
     void notePressed(Synth::Note const);
     void onKey(int key, int direction);
     void volumeChanged(int v);
+    void audioReady(bool ok);
 private:
+    // Played from the computer keyboard, independent of the drill
     Synth::Note playing;
-    void playRandomNote();
-    void changeNote();
     Ui::MainWindow *ui;
 
     QThread synthThread;
     Synth synth;
     Keyboard * kb;
 
-    QTimer delay_timer;
-    QTimer noise_timer;
-    int noise_count;
+    // Synth lives on synthThread, so every call into it is queued there and traced as a
+    // flow from the GUI thread. name must be a string literal.
+    void sendToSynth(char const * name, std::function<void()> call);
+
+    std::unique_ptr<SessionLog> log;
+    std::unique_ptr<NoteSelector> selector;
+
+    // The drill runs on drill_clock, drill_timer wakes it up at its next deadline
+    std::unique_ptr<Drill> drill;
+    QElapsedTimer drill_clock;
+    QTimer drill_timer;
+    void scheduleDrill();
+
+    QElapsedTimer startup;
+    std::optional<qint64> first_paint_ms;
+    std::optional<qint64> audio_ready_ms;
+    std::optional<qint64> audio_failed_ms;
+    void reportStartup() const;
+
+    // F11 toggles tracing, F12 dumps it
+    void dumpTrace();
 
     void keyPressEvent(QKeyEvent * const e) override;
     void keyReleaseEvent(QKeyEvent * const e) override;
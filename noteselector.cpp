@@ -0,0 +1,126 @@
+#include "noteselector.h"
+#include <algorithm>
+
+NoteSelector::NoteSelector(std::vector<Synth::Note> pool, double staleness):
+    pool{std::move(pool)},
+    error(this->pool.size(), INITIAL_ERROR),
+    last_seen(this->pool.size(), 0),
+    current(this->pool.size()),
+    staleness{staleness},
+    now{0},
+    updates_since_rebuild{0}
+{
+    for (size_t i = 0; i < this->pool.size(); ++i) {
+        this->indices[this->pool[i].semitone()] = i;
+    }
+    this->rebuild();
+}
+
+Synth::Note NoteSelector::draw(double u) {
+    if (this->pool.empty()) return Synth::Note{};
+
+    double const total = this->weights.total().at(this->now);
+    size_t const i = this->weights.find(u * total, this->now);
+
+    this->last_seen[i] = this->now;
+    this->update(i);
+    this->now += 1;
+    return this->pool[i];
+}
+
+void NoteSelector::record(Synth::Note note, bool correct) {
+    size_t const i = this->index(note);
+    if (i == this->pool.size()) return;
+    this->error[i] += ERROR_SMOOTHING * ((correct ? 0 : 1) - this->error[i]);
+    this->update(i);
+}
+
+void NoteSelector::seed(Synth::Note note, double error_rate) {
+    size_t const i = this->index(note);
+    if (i == this->pool.size()) return;
+    this->error[i] = std::clamp(error_rate, 0., 1.);
+    this->update(i);
+}
+
+std::vector<Synth::Note> const& NoteSelector::notes() const {
+    return this->pool;
+}
+
+double NoteSelector::weight(Synth::Note note) const {
+    size_t const i = this->index(note);
+    return i == this->pool.size() ? 0 : this->linear(i).at(this->now);
+}
+
+NoteSelector::Linear NoteSelector::linear(size_t i) const {
+    double const e = ERROR_FLOOR + this->error[i];
+    return {e * (1 - this->last_seen[i] / this->staleness), e / this->staleness};
+}
+
+void NoteSelector::update(size_t i) {
+    if (++this->updates_since_rebuild > 64 * this->pool.size()) {
+        this->rebuild();
+        return;
+    }
+    Linear const next = this->linear(i);
+    this->weights.add(i, {next.a - this->current[i].a, next.b - this->current[i].b});
+    this->current[i] = next;
+}
+
+void NoteSelector::rebuild() {
+    for (size_t i = 0; i < this->pool.size(); ++i) {
+        this->current[i] = this->linear(i);
+    }
+    this->weights.reset(this->current);
+    this->updates_since_rebuild = 0;
+}
+
+size_t NoteSelector::index(Synth::Note note) const {
+    auto const found = this->indices.find(note.semitone());
+    return found == this->indices.end() ? this->pool.size() : found->second;
+}
+
+void NoteSelector::Fenwick::reset(std::vector<Linear> const& values) {
+    // O(n) construction: push every node's sum into its parent
+    this->tree.assign(values.size() + 1, Linear{});
+    for (size_t i = 1; i <= values.size(); ++i) {
+        this->tree[i].a += values[i - 1].a;
+        this->tree[i].b += values[i - 1].b;
+        size_t const parent = i + (i & -i);
+        if (parent <= values.size()) {
+            this->tree[parent].a += this->tree[i].a;
+            this->tree[parent].b += this->tree[i].b;
+        }
+    }
+    this->top_bit = 1;
+    while (this->top_bit * 2 <= values.size()) this->top_bit *= 2;
+}
+
+void NoteSelector::Fenwick::add(size_t i, Linear delta) {
+    for (++i; i < this->tree.size(); i += i & -i) {
+        this->tree[i].a += delta.a;
+        this->tree[i].b += delta.b;
+    }
+}
+
+NoteSelector::Linear NoteSelector::Fenwick::total() const {
+    Linear sum;
+    for (size_t i = this->tree.size() - 1; i > 0; i -= i & -i) {
+        sum.a += this->tree[i].a;
+        sum.b += this->tree[i].b;
+    }
+    return sum;
+}
+
+size_t NoteSelector::Fenwick::find(double target, double now) const {
+    size_t const n = this->tree.size() - 1;
+    size_t position = 0;
+    for (size_t step = this->top_bit; step > 0; step /= 2) {
+        size_t const next = position + step;
+        if (next <= n && this->tree[next].at(now) <= target) {
+            position = next;
+            target -= this->tree[next].at(now);
+        }
+    }
+    // Rounding can push a target equal to the total just past the end
+    return std::min(position, n - 1);
+}
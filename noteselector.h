@@ -0,0 +1,70 @@
+#ifndef NOTESELECTOR_H
+#define NOTESELECTOR_H
+
+#include <vector>
+#include <unordered_map>
+#include <stddef.h>
+#include "synth.h"
+
+// Spaced-repetition choice of the next target note.
+//
+// Every note in the pool is weighted by its recent error rate and by how many draws ago it
+// was last asked:
+//     weight = error * (1 + (now - last_seen) / staleness)
+// which is linear in now, so it's kept as a + b * now in a Fenwick tree. Recording a result
+// and drawing a note are both O(log n), whatever the size of the pool.
+class NoteSelector {
+public:
+    explicit NoteSelector(std::vector<Synth::Note> pool, double staleness = 12);
+
+    // u is uniform in [0, 1)
+    Synth::Note draw(double u);
+    void record(Synth::Note, bool correct);
+    // Start a note from a known error rate instead of the default, e.g. from the session log
+    void seed(Synth::Note, double error_rate);
+
+    std::vector<Synth::Note> const& notes() const;
+    double weight(Synth::Note) const;
+
+private:
+    static constexpr double ERROR_FLOOR = 0.05;
+    static constexpr double INITIAL_ERROR = 0.5;
+    static constexpr double ERROR_SMOOTHING = 0.3;
+
+    struct Linear {
+        double a = 0;
+        double b = 0;
+        double at(double now) const { return a + b * now; }
+    };
+
+    class Fenwick {
+    public:
+        void reset(std::vector<Linear> const& values);
+        void add(size_t i, Linear delta);
+        Linear total() const;
+        // The first index whose prefix sum at now exceeds target
+        size_t find(double target, double now) const;
+    private:
+        std::vector<Linear> tree;
+        size_t top_bit;
+    };
+
+    Linear linear(size_t i) const;
+    void update(size_t i);
+    void rebuild();
+    size_t index(Synth::Note) const;
+
+    std::vector<Synth::Note> pool;
+    std::unordered_map<int, size_t> indices;
+    std::vector<double> error;
+    std::vector<double> last_seen;
+    std::vector<Linear> current;
+    Fenwick weights;
+
+    double staleness;
+    double now;
+    // Floating point drift from incremental updates is cleared with a rebuild every so often
+    size_t updates_since_rebuild;
+};
+
+#endif // NOTESELECTOR_H
@@ -0,0 +1,98 @@
+// Renders every drill note (or, with --full-range, every piano key) through both Voice
+// specializations and checks the integer path against the floating point reference:
+// signal-to-error ratio and worst sample error per note, and render cost per sample of each
+// path. Exits non-zero when any note falls below --min-snr; registered with ctest.
+
+#include "synth.h"
+#include "voice.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace {
+
+struct Rendered {
+    std::vector<int16_t> samples;
+    qint64 ns;
+};
+
+// The note is held for hold_frames and then released, rendered in blocks like the device callback
+template <typename Arithmetic>
+Rendered render(double frequency, int hold_frames, int release_frames, int block) {
+    Voice<Arithmetic> voice({15, 13, 0.7, 0., 2}, Synth::SAMPLE_RATE);
+    Rendered out;
+    out.samples.resize(hold_frames + release_frames);
+    auto const run = [&voice, &out, block](int from, int to) {
+        for (int i = from; i < to; i += block) {
+            voice.render(out.samples.data() + i, std::min(block, to - i));
+        }
+    };
+    QElapsedTimer timer;
+    timer.start();
+    voice.play(frequency);
+    run(0, hold_frames);
+    voice.release();
+    run(hold_frames, hold_frames + release_frames);
+    out.ns = timer.nsecsElapsed();
+    return out;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication a(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Compares the fixed point render path against the floating point one.");
+    parser.addHelpOption();
+    QCommandLineOption const min_snr_option("min-snr", "Lowest acceptable signal-to-error ratio in dB.", "dB", "60");
+    QCommandLineOption const block_option("block", "Frames rendered per call.", "frames", "256");
+    QCommandLineOption const hold_option("hold", "Time each note is held before release, in ms.", "ms", "1000");
+    QCommandLineOption const full_range_option("full-range", "Every piano key, A0 to C8, instead of the drill's octaves 3 to 5.");
+    parser.addOptions({min_snr_option, block_option, hold_option, full_range_option});
+    parser.process(a);
+
+    double const min_snr = parser.value(min_snr_option).toDouble();
+    int const block = std::max(1, parser.value(block_option).toInt());
+    int const hold_frames = parser.value(hold_option).toInt() * Synth::SAMPLE_RATE / 1000;
+    int const release_frames = Synth::SAMPLE_RATE / 2;
+    bool const full_range = parser.isSet(full_range_option);
+    int const lowest = full_range ? Synth::Note(0, Synth::A).semitone() : Synth::Note(3, Synth::C).semitone();
+    int const highest = full_range ? Synth::Note(8, Synth::C).semitone() : Synth::Note(5, Synth::B).semitone();
+
+    QTextStream out(stdout);
+    out << "Note   SNR (dB)  max error\n";
+    double worst_snr = std::numeric_limits<double>::infinity();
+    qint64 float_ns = 0, fixed_ns = 0, frames = 0;
+    for (int semitone = lowest; semitone <= highest; ++semitone) {
+        Synth::Note const note(semitone);
+        double const frequency = Synth::noteFrequency(note);
+        Rendered const reference = render<double>(frequency, hold_frames, release_frames, block);
+        Rendered const fixed = render<FixedPoint>(frequency, hold_frames, release_frames, block);
+
+        double signal = 0, error = 0;
+        int max_error = 0;
+        for (size_t i = 0; i < reference.samples.size(); ++i) {
+            int const difference = fixed.samples[i] - reference.samples[i];
+            signal += double(reference.samples[i]) * reference.samples[i];
+            error += double(difference) * difference;
+            max_error = std::max(max_error, std::abs(difference));
+        }
+        double const snr = error > 0 ? 10 * std::log10(signal / error) : std::numeric_limits<double>::infinity();
+        worst_snr = std::min(worst_snr, snr);
+        float_ns += reference.ns;
+        fixed_ns += fixed.ns;
+        frames += reference.samples.size();
+
+        out << QString("%1 %2 %3\n").arg(QString(note), -4).arg(snr, 10, 'f', 1).arg(max_error, 10);
+    }
+
+    out << "Worst SNR:         " << QString::number(worst_snr, 'f', 1) << " dB (minimum " << min_snr << ")\n";
+    out << "Floating point:    " << QString::number(double(float_ns) / frames, 'f', 1) << " ns/sample\n";
+    out << "Fixed point:       " << QString::number(double(fixed_ns) / frames, 'f', 1) << " ns/sample\n";
+    return worst_snr >= min_snr ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+#include "sessionlog.h"
+#include <QDateTime>
+#include <QDebug>
+#include <algorithm>
+#include <cstdlib>
+#include <type_traits>
+
+static_assert(sizeof(SessionLog::Record) == 16, "Session log records are stored as is");
+static_assert(std::is_trivially_copyable<SessionLog::NoteSummary>::value, "Summaries are stored as is");
+
+SessionLog::SessionLog(QString const& path):
+    file{path},
+    summary_file{path + ".summary"},
+    count{0},
+    mapped{nullptr},
+    mapped_count{0}
+{
+    if (!this->file.open(QIODevice::ReadWrite)) {
+        qWarning() << "Cannot open session log" << path << this->file.errorString();
+        return;
+    }
+
+    Header header{LOG_MAGIC, VERSION, sizeof(Record), 0};
+    if (this->file.size() == 0) {
+        this->file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+        this->file.flush();
+    } else {
+        Header existing;
+        if (this->file.read(reinterpret_cast<char*>(&existing), sizeof(existing)) != sizeof(existing)
+                || existing.magic != header.magic || existing.version != header.version
+                || existing.record_size != header.record_size) {
+            qWarning() << "Not a session log, refusing to append to" << path;
+            this->file.close();
+            return;
+        }
+    }
+
+    // A crash mid-write leaves a partial record behind, drop it
+    this->count = (this->file.size() - int64_t(sizeof(Header))) / int64_t(sizeof(Record));
+    this->file.resize(sizeof(Header) + this->count * sizeof(Record));
+
+    this->loadSummary();
+}
+
+SessionLog::~SessionLog() {
+    if (this->isOpen()) {
+        this->saveSummary();
+    }
+}
+
+bool SessionLog::isOpen() const {
+    return this->file.isOpen();
+}
+
+void SessionLog::append(Synth::Note target, Synth::Note guess, int confidence, uint32_t response_ms, bool first_attempt) {
+    if (!this->isOpen()) return;
+
+    Record const record{
+        QDateTime::currentMSecsSinceEpoch(),
+        response_ms,
+        static_cast<uint8_t>(std::clamp(target.semitone(), 0, NOTE_AMOUNT - 1)),
+        static_cast<uint8_t>(std::clamp(guess.semitone(), 0, NOTE_AMOUNT - 1)),
+        static_cast<uint8_t>(first_attempt ? Record::FIRST_ATTEMPT : 0),
+        static_cast<uint8_t>(std::clamp(confidence, 0, 255)),
+    };
+
+    // Some platforms refuse to grow a file that is mapped, records() maps it again on demand
+    if (this->mapped) {
+        this->file.unmap(this->mapped);
+        this->mapped = nullptr;
+        this->mapped_count = 0;
+    }
+
+    this->file.seek(sizeof(Header) + this->count * sizeof(Record));
+    if (this->file.write(reinterpret_cast<char const*>(&record), sizeof(record)) != sizeof(record)) {
+        qWarning() << "Failed to append to session log" << this->file.errorString();
+        return;
+    }
+    this->file.flush();
+    ++this->count;
+    this->fold(record);
+}
+
+SessionLog::Record const * SessionLog::records() {
+    if (this->mapped_count != this->count) {
+        if (this->mapped) {
+            this->file.unmap(this->mapped);
+            this->mapped = nullptr;
+        }
+        if (this->count > 0) {
+            this->mapped = this->file.map(sizeof(Header), this->count * sizeof(Record));
+        }
+        this->mapped_count = this->mapped ? this->count : 0;
+    }
+    return reinterpret_cast<Record const*>(this->mapped);
+}
+
+int64_t SessionLog::size() const {
+    return this->count;
+}
+
+SessionLog::NoteSummary const& SessionLog::summary(Synth::Note note) const {
+    return this->summaries[std::clamp(note.semitone(), 0, NOTE_AMOUNT - 1)];
+}
+
+void SessionLog::fold(Record const& record) {
+    // Records come straight from disk, a foreign or damaged one must not index past the table
+    if (record.target >= NOTE_AMOUNT) return;
+    NoteSummary & summary = this->summaries[record.target];
+    ++summary.attempts;
+    summary.correct += record.correct();
+    if (record.first_attempt()) {
+        ++summary.first_attempts;
+        summary.first_correct += record.correct();
+    }
+    summary.total_response_ms += record.response_ms;
+    summary.total_abs_difference += std::abs(record.difference());
+}
+
+void SessionLog::loadSummary() {
+    int64_t summarized = 0;
+    if (this->summary_file.open(QIODevice::ReadOnly)) {
+        Header header;
+        decltype(this->summaries) loaded;
+        bool const valid = this->summary_file.read(reinterpret_cast<char*>(&header), sizeof(header)) == sizeof(header)
+                && header.magic == SUMMARY_MAGIC && header.version == VERSION && header.record_size == sizeof(Record)
+                && header.records <= this->count
+                && this->summary_file.read(reinterpret_cast<char*>(&loaded), sizeof(loaded)) == sizeof(loaded);
+        if (valid) {
+            this->summaries = loaded;
+            summarized = header.records;
+        }
+        this->summary_file.close();
+    }
+
+    if (summarized < this->count) {
+        Record const * const records = this->records();
+        if (records) {
+            std::for_each(records + summarized, records + this->count, [this](Record const& r) { this->fold(r); });
+        }
+    }
+}
+
+void SessionLog::saveSummary() {
+    if (!this->summary_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Cannot write session summary" << this->summary_file.errorString();
+        return;
+    }
+    Header const header{SUMMARY_MAGIC, VERSION, sizeof(Record), this->count};
+    this->summary_file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    this->summary_file.write(reinterpret_cast<char const*>(&this->summaries), sizeof(this->summaries));
+    this->summary_file.close();
+}
+
+double SessionLog::NoteSummary::accuracy() const {
+    return this->attempts ? double(this->correct) / this->attempts : 0;
+}
+
+double SessionLog::NoteSummary::first_try_accuracy() const {
+    return this->first_attempts ? double(this->first_correct) / this->first_attempts : 0;
+}
+
+double SessionLog::NoteSummary::mean_response_ms() const {
+    return this->attempts ? double(this->total_response_ms) / this->attempts : 0;
+}
@@ -0,0 +1,84 @@
+#ifndef SESSIONLOG_H
+#define SESSIONLOG_H
+
+#include <QFile>
+#include <QString>
+#include <array>
+#include <cstdlib>
+#include <stdint.h>
+#include "synth.h"
+
+// Append-only log of every guess, stored as fixed-size records behind a small header.
+// Records are read through a memory mapping; per-note aggregates are kept up to date on
+// every append and persisted in a sidecar file so opening a long log only folds in the
+// records written since the summary was last saved.
+class SessionLog {
+public:
+    struct Record {
+        int64_t timestamp_ms;   // Wall clock at the guess, ms since the epoch
+        uint32_t response_ms;   // From the prompt to the guess
+        uint8_t target;         // Semitone, see Synth::Note::semitone
+        uint8_t guess;
+        uint8_t flags;
+        uint8_t confidence;
+
+        static constexpr uint8_t FIRST_ATTEMPT = 1;     // The first guess at this prompt
+
+        int difference() const { return int(this->guess) - int(this->target); }
+        bool correct() const { return std::abs(this->difference()) <= this->confidence; }
+        bool first_attempt() const { return this->flags & FIRST_ATTEMPT; }
+    };
+
+    struct NoteSummary {
+        uint32_t attempts = 0;
+        uint32_t correct = 0;
+        // Only the first guess at each prompt, which is what the note selector learns from
+        uint32_t first_attempts = 0;
+        uint32_t first_correct = 0;
+        uint64_t total_response_ms = 0;
+        uint64_t total_abs_difference = 0;
+
+        double accuracy() const;
+        double first_try_accuracy() const;
+        double mean_response_ms() const;
+    };
+
+    static constexpr int NOTE_AMOUNT = 128;
+
+    explicit SessionLog(QString const& path);
+    ~SessionLog();
+
+    bool isOpen() const;
+    void append(Synth::Note target, Synth::Note guess, int confidence, uint32_t response_ms, bool first_attempt);
+
+    // Valid until the next append
+    Record const * records();
+    int64_t size() const;
+
+    NoteSummary const& summary(Synth::Note) const;
+    void saveSummary();
+
+private:
+    struct Header {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t record_size;
+        int64_t records;        // Only used by the summary sidecar
+    };
+
+    static constexpr uint32_t LOG_MAGIC = 0x474c5050;      // "PPLG"
+    static constexpr uint32_t SUMMARY_MAGIC = 0x53535050;  // "PPSS"
+    static constexpr uint16_t VERSION = 1;
+
+    void loadSummary();
+    void fold(Record const&);
+
+    QFile file;
+    QFile summary_file;
+    int64_t count;
+    uchar * mapped;
+    int64_t mapped_count;
+    std::array<NoteSummary, NOTE_AMOUNT> summaries;
+};
+
+#endif // SESSIONLOG_H
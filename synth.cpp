@@ -1,4 +1,5 @@
 #include "synth.h"
+#include "trace.h"
 #include <QDebug>
 #include <cmath>
 #include <limits>
@@ -6,20 +7,25 @@
 #include <stdlib.h>
 #include <algorithm>
 #include <cmath>
+#include <utility>
 
 Synth::Synth(QObject *parent) : QObject(parent),
-    envelope{15, 13, 0.7, 0., 2},
+    voice{{15, 13, 0.7, 0., 2}, SAMPLE_RATE},
     volume{0.5, 1},
-    frequency{0},
     synthVST{},
     outputDevice{nullptr},
-    rawOutputDevice{nullptr}
+    rawOutputDevice{nullptr},
+    tuner{30, 10, 500, 1.},
+    starved{false},
+    block_frames{0},
+    resize_pending{false},
+    silent_frames{0}
 {
-    this->sample_buffer.resize(20000);
 }
 
+// Runs on the synth thread: querying and opening the device can take a while on some backends
 void Synth::start() {
-    this->format.setSampleRate(22050);
+    this->format.setSampleRate(SAMPLE_RATE);
     this->format.setChannelCount(1);
     this->format.setSampleSize(16);
     this->format.setCodec("audio/pcm");
@@ -29,11 +35,13 @@ void Synth::start() {
     QAudioDeviceInfo info(QAudioDeviceInfo::defaultOutputDevice());
     if (!info.isFormatSupported(format)) {
         qWarning()<<"raw audio format not supported by backend, cannot play audio.";
+        emit audioReady(false);
         return;
     }
 
     this->outputDevice =  decltype(this->outputDevice)::create(format, nullptr);
     this->connect(this->outputDevice.get(), &QAudioOutput::notify, this, &Synth::writeSamples);
+    this->connect(this->outputDevice.get(), &QAudioOutput::stateChanged, this, &Synth::deviceStateChanged);
 
     this->generationTimer = decltype(this->generationTimer)::create();
     this->generationTimer->setSingleShot(false);
@@ -44,133 +52,137 @@ void Synth::start() {
     this->volumeTimer->setSingleShot(false);
     this->volumeTimer->setInterval(1);
     connect(this->volumeTimer.get(), &QTimer::timeout, this, [this](){
+        TRACE_SCOPE("Synth::volumeTimer");
         this->volume.advance(1);
         this->outputDevice->setVolume(this->volume.get());
     });
     this->volumeTimer->start();
 
-    int constexpr notify_interval_ms = 10;
+    this->applyBufferSize();
+    emit audioReady(this->outputDevice->error() == QAudio::NoError);
+}
+
+// Buffer size and notify interval only take effect when the device starts, so this restarts
+// it and drops whatever was still queued. That is only done where nobody can hear it: when
+// the queue holds nothing but silence, or when a new note starts, whose attack cuts off the
+// previous one anyway. Until then a resize the tuner asks for stays pending.
+void Synth::applyBufferSize() {
+    if (!this->outputDevice) return;
+    this->resize_pending = false;
+    int const buffer_ms = this->tuner.bufferMs();
+    this->block_frames = this->format.framesForDuration(this->tuner.blockMs() * 1000);
+    this->sample_buffer.resize(this->block_frames);
+
+    if (this->rawOutputDevice) {
+        this->outputDevice->stop();
+    }
+    this->outputDevice->setBufferSize(this->format.bytesForDuration(buffer_ms * 1000));
+    int const notify_interval_ms = std::max(2, buffer_ms / 4);
     this->outputDevice->setNotifyInterval(notify_interval_ms);
     if (this->outputDevice->notifyInterval() != notify_interval_ms) {
         qWarning() << "Notify interval doesn't match: " << this->outputDevice->notifyInterval();
     }
     this->rawOutputDevice = this->outputDevice->start();
+    Trace::counter("audio buffer ms", buffer_ms);
+
+    // The first callback after a restart has no previous one to measure against
+    this->callback_clock.invalidate();
+    this->starved = false;
+    this->writeSamples();
+}
+
+void Synth::setLatencyTarget(int ms) {
+    this->tuner.setTarget(ms);
+    if (this->tuner.takeChange() && this->rawOutputDevice) {
+        this->resize_pending = true;
+    }
+}
+
+void Synth::setMaxUnderrunRate(double per_minute) {
+    this->tuner.setMaxUnderrunRate(per_minute);
+}
+
+// In push mode the device goes idle once it has played everything it was given. Refill right
+// away instead of waiting for a notify that some backends stop sending while idle.
+void Synth::deviceStateChanged(QAudio::State state) {
+    if (state == QAudio::IdleState && this->outputDevice->error() == QAudio::UnderrunError) {
+        this->starved = true;
+        this->writeSamples();
+    }
 }
 
 void Synth::stop() {
+    // Everything created in start() lives on the synth thread, so tear it down here as well
+    this->generationTimer.reset();
+    this->volumeTimer.reset();
     if (this->outputDevice) {
         this->outputDevice->stop();
+        this->outputDevice.reset();
     }
+    this->rawOutputDevice = nullptr;
 }
 
 void Synth::stopNote() {
-    this->envelope.off();
+    this->voice.release();
 }
 
-void Synth::playNote(Note const note) {
-    // Calculate the frequency, store it, generate it on the callback
+double Synth::noteFrequency(Note const note) {
     static constexpr double reference_freq = 440;
     static constexpr int reference_octave = 4;
 
     int const octave_diff = note.octave - reference_octave;
     int const note_diff = note.note_class - PitchClass::A;
 
-    this->playFrequency(reference_freq * std::pow(2, octave_diff + note_diff / 12.));
+    return reference_freq * std::pow(2, octave_diff + note_diff / 12.);
 }
 
+void Synth::playNote(Note const note) {
+    this->playFrequency(noteFrequency(note));
+}
+
+// Store the frequency, generate it on the callback
 void Synth::playFrequency(double freq) {
-    this->frequency = freq;
-    std::fill(std::begin(this->phase_offsets), std::end(this->phase_offsets), 0);
-    this->envelope.on();
+    this->voice.play(freq);
+    if (this->resize_pending) {
+        this->applyBufferSize();
+    }
 }
 
 void Synth::writeSamples() {
-    double constexpr harmonics_db[] = {-31, -46, -54, -52, -68, -55, -55};
-    int const to_generate = this->outputDevice->bytesFree() / 2;
-    double const sample_period = 1. / this->format.sampleRate();
-    double const normalization = 440. / this->frequency;
-
-    for (int i = 0, j = 0; i < to_generate; ++i, j += 2) {
-        double samplef = 0;
-        for (int h = 0; h < 7; h++) {
-            double const harmonic_power = std::pow(10, (harmonics_db[h] - harmonics_db[0]) / 10.);
-            samplef += harmonic_power * std::sin(this->phase_offsets[h]);
-            this->phase_offsets[h] += this->frequency * (h+1) * 2 * 3.1415926 * sample_period;
+    TRACE_SCOPE("Synth::writeSamples");
+    if (!this->rawOutputDevice) return;
+    int const free_frames = this->format.framesForBytes(this->outputDevice->bytesFree());
+    if (this->callback_clock.isValid()) {
+        // Finding the buffer completely empty means the device ran dry before we came back
+        bool const underrun = this->starved || this->outputDevice->bytesFree() >= this->outputDevice->bufferSize();
+        double const interval_ms = this->callback_clock.nsecsElapsed() / 1e6;
+        Trace::counter("callback interval ms", interval_ms);
+        if (underrun) {
+            Trace::instant("audio underrun");
+        }
+        this->tuner.observe(interval_ms, underrun);
+        if (this->tuner.takeChange()) {
+            this->resize_pending = true;
+            Trace::instant("audio resize pending");
         }
-        samplef *= normalization * this->envelope.value() * std::numeric_limits<int16_t>::max() / 7;
-        uint16_t const sample = samplef;
-        char bytes[sizeof(sample)];
-        memcpy(bytes, &sample, sizeof(sample));
-        sample_buffer[j] = (bytes[0]);
-        sample_buffer[j + 1] = (bytes[1]);
-        this->envelope.advance(sample_period);
-    }
-    this->rawOutputDevice->write(this->sample_buffer.data(), to_generate * 2);
-
-    // Renormalize phase_offsets
-    for (int h = 0; h < 7; h++) {
-        this->phase_offsets[h] = fmod(this->phase_offsets[h], 2*3.14159265);
     }
-}
-
-Synth::ADSREnvelope::ADSREnvelope(double a, double d, double sv, double sr, double r):
-    t{0},
-    attack{a},
-    decay{d},
-    sustain_value{sv},
-    sustain_rate{sr},
-    release{r},
-    state{Synth::ADSREnvelope::State::IDLE} {
-}
-
-void Synth::ADSREnvelope::advance(double dt) {
-    if (this->state == State::IDLE) return;
-    this->t += dt;
-    switch (this->state) {
-        case (State::IDLE): break;
-        case (State::ATTACK): {
-            this->cvalue += dt * this->attack;
-            if (this->cvalue >= 1.0) {
-                this->state = State::DECAY;
-                this->t = 0;
-            }
-        } break;
-        case (State::DECAY): {
-            this->cvalue -= dt * this->decay;
-            if (this->cvalue <= this->sustain_value) {
-                this->state = State::SUSTAIN;
-                this->t = 0;
-            }
-        } break;
-        case (State::SUSTAIN): {
-            this->cvalue -= dt * this->sustain_rate;
-            if (this->cvalue <= 0) {
-                this->state = State::IDLE;
-                this->t = 0;
+    if (this->resize_pending && this->silent_frames >= this->format.framesForBytes(this->outputDevice->bufferSize())) {
+        // Not from inside the device's own notification, and only if no note started meanwhile
+        QMetaObject::invokeMethod(this, [this]() {
+            if (this->resize_pending && this->voice.idle()) {
+                this->applyBufferSize();
             }
-        } break;
-        case (State::RELEASE): {
-            this->cvalue -= dt * this->release;
-            if (this->cvalue <= 0) {
-                this->state = State::IDLE;
-                this->t = 0;
-            }
-        } break;
+        }, Qt::QueuedConnection);
     }
-}
-
-double Synth::ADSREnvelope::value() {
-    return this->cvalue;
-}
-
-void Synth::ADSREnvelope::on() {
-    this->state = State::ATTACK;
-    this->t = 0;
-    this->cvalue = 0;
-}
+    this->callback_clock.start();
+    this->starved = false;
 
-void Synth::ADSREnvelope::off() {
-    this->state = State::RELEASE;
+    int const to_generate = std::min(free_frames, this->block_frames);
+    Trace::counter("samples written", to_generate);
+    bool const silent = this->voice.idle();
+    this->voice.render(this->sample_buffer.data(), to_generate);
+    this->silent_frames = silent ? this->silent_frames + to_generate : 0;
+    this->rawOutputDevice->write(reinterpret_cast<char const *>(this->sample_buffer.data()), this->format.bytesForFrames(to_generate));
 }
 
 std::ostream& operator<<(std::ostream& out, Synth::PitchClass c) {
@@ -208,3 +220,87 @@ void Synth::Parameter::advance(int ms) {
 void Synth::Parameter::set(Float v) {
     this->target = v;
 }
+
+Synth::BufferTuner::BufferTuner(int target_ms, int min_ms, int max_ms, double max_underruns_per_minute):
+    target_ms{std::clamp(target_ms, min_ms, max_ms)},
+    min_ms{min_ms},
+    max_ms{max_ms},
+    max_underruns_per_minute{max_underruns_per_minute},
+    buffer_ms{std::clamp(2 * target_ms, min_ms, max_ms)},
+    changed{false},
+    now_ms{0},
+    window_ms{0},
+    worst_interval_ms{0},
+    quiet_since_ms{0} {
+}
+
+void Synth::BufferTuner::setTarget(int ms) {
+    this->target_ms = std::clamp(ms, this->min_ms, this->max_ms);
+    // Asking for more latency is always safe, asking for less waits for a clean stretch
+    if (this->buffer_ms < this->target_ms) {
+        this->resize(this->target_ms);
+    }
+}
+
+void Synth::BufferTuner::setMaxUnderrunRate(double per_minute) {
+    this->max_underruns_per_minute = per_minute;
+}
+
+void Synth::BufferTuner::observe(double interval_ms, bool underrun) {
+    this->now_ms += interval_ms;
+    this->window_ms += interval_ms;
+    this->worst_interval_ms = std::max(this->worst_interval_ms, interval_ms);
+    if (underrun) {
+        this->underrun_times.push_back(this->now_ms);
+        this->quiet_since_ms = this->now_ms;
+    }
+    if (this->window_ms < WINDOW_MS) return;
+
+    double const horizon_ms = this->horizonMs();
+    while (!this->underrun_times.empty() && this->underrun_times.front() < this->now_ms - horizon_ms) {
+        this->underrun_times.pop_front();
+    }
+    double const allowed = this->max_underruns_per_minute * horizon_ms / 60000;
+    Trace::counter("underruns per minute", this->underrun_times.size() * 60000. / std::min(this->now_ms, horizon_ms));
+
+    // Whatever the rate, the buffer has to outlast the longest gap between two callbacks
+    int const floor_ms = std::max(this->target_ms, static_cast<int>(std::ceil(2 * this->worst_interval_ms)));
+    double const quiet_needed_ms = std::max(MIN_QUIET_MS, 60000. / std::max(this->max_underruns_per_minute, 1e-3));
+    if (this->underrun_times.size() > allowed) {
+        // Those happened at the old size, the new one starts with a clean slate
+        this->underrun_times.clear();
+        this->quiet_since_ms = this->now_ms;
+        this->resize(std::max(this->buffer_ms * 3 / 2, floor_ms));
+    } else if (this->now_ms - this->quiet_since_ms >= quiet_needed_ms && this->buffer_ms > floor_ms) {
+        this->quiet_since_ms = this->now_ms;
+        this->resize(std::max(this->buffer_ms * 3 / 4, floor_ms));
+    }
+
+    this->window_ms = 0;
+    this->worst_interval_ms = 0;
+}
+
+// Long enough that the threshold allows a few underruns in it
+double Synth::BufferTuner::horizonMs() const {
+    return std::max(MIN_HORIZON_MS, HORIZON_UNDERRUNS * 60000 / std::max(this->max_underruns_per_minute, 1e-3));
+}
+
+int Synth::BufferTuner::bufferMs() const {
+    return this->buffer_ms;
+}
+
+int Synth::BufferTuner::blockMs() const {
+    return std::max(1, this->buffer_ms / 2);
+}
+
+bool Synth::BufferTuner::takeChange() {
+    return std::exchange(this->changed, false);
+}
+
+void Synth::BufferTuner::resize(int ms) {
+    ms = std::clamp(ms, this->min_ms, this->max_ms);
+    if (ms != this->buffer_ms) {
+        this->buffer_ms = ms;
+        this->changed = true;
+    }
+}
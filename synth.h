@@ -7,7 +7,10 @@
 #include <QSharedPointer>
 #include <stdint.h>
 #include <QMutex>
+#include <QElapsedTimer>
 #include <tuple>
+#include <deque>
+#include "voice.h"
 
 class Synth : public QObject {
     Q_OBJECT
@@ -45,6 +48,8 @@ public:
 
         Note(): Note{4, PitchClass::A} {}
         Note(int o, int c): octave{o}, note_class{static_cast<PitchClass>(c)} {}
+        explicit Note(int semitone): Note{semitone / NOTECLASS_AMOUNT, semitone % NOTECLASS_AMOUNT} {}
+        int semitone() const { return octave * NOTECLASS_AMOUNT + note_class; }
         bool operator==(Note other) const { return std::make_tuple(octave, note_class) == std::make_tuple(other.octave, other.note_class); }
 
         operator QString() const {
@@ -67,29 +72,53 @@ public:
     };
 
 
-    class ADSREnvelope {
+    // Picks the device buffer length from what the callbacks actually look like: grows it
+    // when the underruns within a sliding horizon exceed what the threshold allows over that
+    // horizon, shrinks it back towards the target latency after a quiet stretch, but never
+    // below twice the worst callback gap. The horizon covers several underruns' worth of the
+    // threshold, so a single one never triggers growth on its own, and the quiet stretch is
+    // long enough that probing a smaller buffer stays within the threshold.
+    class BufferTuner {
     public:
-        ADSREnvelope(double a, double d, double sv, double sr, double r);
-        void advance(double dt);
-        double value();
-        void on();
-        void off();
+        BufferTuner(int target_ms, int min_ms, int max_ms, double max_underruns_per_minute);
+        void setTarget(int ms);
+        void setMaxUnderrunRate(double per_minute);
+        // One notify callback: time since the previous one and whether the device ran dry
+        void observe(double interval_ms, bool underrun);
+        int bufferMs() const;
+        // Most audio rendered per callback, half the buffer so the device never gets further ahead
+        int blockMs() const;
+        // True once after the buffer length changed
+        bool takeChange();
     protected:
-        double t;
-        double cvalue;
-        enum class State {
-            IDLE,
-            ATTACK,
-            DECAY,
-            SUSTAIN,
-            RELEASE,
-            OFF
-        };
-
-        double attack, decay, sustain_value, sustain_rate, release;
-        State state;
+        static constexpr double WINDOW_MS = 2000;
+        static constexpr double MIN_QUIET_MS = 3 * WINDOW_MS;
+        static constexpr double MIN_HORIZON_MS = 5 * 60000;
+        static constexpr double HORIZON_UNDERRUNS = 3;
+        int target_ms, min_ms, max_ms;
+        double max_underruns_per_minute;
+        int buffer_ms;
+        bool changed;
+        // Audio time, summed from the callback intervals
+        double now_ms;
+        double window_ms;
+        double worst_interval_ms;
+        std::deque<double> underrun_times;
+        // Last underrun or resize
+        double quiet_since_ms;
+        double horizonMs() const;
+        void resize(int ms);
     };
 
+    static constexpr int SAMPLE_RATE = 22050;
+    static double noteFrequency(Note);
+
+#ifdef PERFECT_PITCH_FIXED_POINT
+    using RenderArithmetic = FixedPoint;
+#else
+    using RenderArithmetic = double;
+#endif
+
     static constexpr char const * const NOTECLASS_NAMES[NOTECLASS_AMOUNT] = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
 
 public slots:
@@ -99,24 +128,36 @@ public slots:
     void stopNote();
     void playFrequency(double freq);
     void changeVolume(double v);
+    void setLatencyTarget(int ms);
+    void setMaxUnderrunRate(double per_minute);
 
 protected slots:
     void writeSamples();
+    void deviceStateChanged(QAudio::State state);
 signals:
+    void audioReady(bool ok);
 
 protected:
-    ADSREnvelope envelope;
+    Voice<RenderArithmetic> voice;
     QAudioFormat format;
     Parameter volume;
-    double frequency;
-    double phase_offsets[7];
     QMutex sample_buffer_mutex;
-    QVector<char> sample_buffer;
+    QVector<int16_t> sample_buffer;
     QLibrary synthVST;
     QSharedPointer<QAudioOutput> outputDevice;
     QSharedPointer<QTimer> generationTimer;
     QSharedPointer<QTimer> volumeTimer;
     QIODevice * rawOutputDevice;
+    BufferTuner tuner;
+    QElapsedTimer callback_clock;
+    bool starved;
+    int block_frames;
+    // The tuner asked for a new size that can't be applied without being heard yet
+    bool resize_pending;
+    // Frames rendered since the voice went idle, all of them silence
+    int64_t silent_frames;
+
+    void applyBufferSize();
 };
 
 #endif // SYNTH_H
@@ -0,0 +1,186 @@
+#include "trace.h"
+#include <QCoreApplication>
+#include <QDebug>
+#include <QFile>
+#include <QMutex>
+#include <QTextStream>
+#include <QThread>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+std::atomic<bool> Trace::active{false};
+
+namespace {
+
+struct Event {
+    char const * name;
+    int64_t ts;
+    int64_t dur;
+    double value;
+    uint64_t id;
+    char phase;
+};
+
+// Single producer ring: only the owning thread writes, head is published after each event.
+// Each slot is a seqlock: its stamp is odd while the writer fills it and 2 * (n + 1) once it
+// holds event n. A reader keeps an event only if the stamp says so both before and after
+// copying it, so anything torn or lapped by the writer in the meantime is dropped. The fields
+// are relaxed atomics so the concurrent copy is not a data race.
+struct Slot {
+    std::atomic<uint64_t> stamp{0};
+    std::atomic<char const *> name{nullptr};
+    std::atomic<int64_t> ts{0};
+    std::atomic<int64_t> dur{0};
+    std::atomic<double> value{0};
+    std::atomic<uint64_t> id{0};
+    std::atomic<char> phase{0};
+};
+
+struct Buffer {
+    static constexpr uint64_t CAPACITY = 1 << 16;
+    std::array<Slot, CAPACITY> slots;
+    std::atomic<uint64_t> head{0};
+    int tid;
+    QString name;
+};
+
+auto const epoch = std::chrono::steady_clock::now();
+std::atomic<uint64_t> next_flow{1};
+
+QMutex registry_mutex;
+std::vector<std::unique_ptr<Buffer>> registry;
+
+// Buffers are never freed, so events of threads that already finished still get dumped
+Buffer * registerThread() {
+    auto buffer = std::make_unique<Buffer>();
+    QThread * const thread = QThread::currentThread();
+    QMutexLocker lock(&registry_mutex);
+    buffer->tid = static_cast<int>(registry.size()) + 1;
+    buffer->name = thread->objectName();
+    if (buffer->name.isEmpty()) {
+        bool const gui = QCoreApplication::instance() && QCoreApplication::instance()->thread() == thread;
+        buffer->name = gui ? QString("gui") : QString("thread %1").arg(buffer->tid);
+    }
+    registry.push_back(std::move(buffer));
+    return registry.back().get();
+}
+
+void record(Event const& event) {
+    thread_local Buffer * const buffer = registerThread();
+    uint64_t const head = buffer->head.load(std::memory_order_relaxed);
+    Slot & slot = buffer->slots[head % Buffer::CAPACITY];
+    slot.stamp.store(2 * head + 1, std::memory_order_relaxed);
+    // The odd stamp has to be visible before any of the fields change
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name.store(event.name, std::memory_order_relaxed);
+    slot.ts.store(event.ts, std::memory_order_relaxed);
+    slot.dur.store(event.dur, std::memory_order_relaxed);
+    slot.value.store(event.value, std::memory_order_relaxed);
+    slot.id.store(event.id, std::memory_order_relaxed);
+    slot.phase.store(event.phase, std::memory_order_relaxed);
+    slot.stamp.store(2 * head + 2, std::memory_order_release);
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+}
+
+void Trace::setEnabled(bool on) {
+    active.store(on, std::memory_order_relaxed);
+}
+
+int64_t Trace::now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Trace::complete(char const * name, int64_t start_us, int64_t duration_us) {
+    if (!enabled()) return;
+    record({name, start_us, duration_us, 0, 0, 'X'});
+}
+
+void Trace::instant(char const * name) {
+    if (!enabled()) return;
+    record({name, now(), 0, 0, 0, 'i'});
+}
+
+void Trace::counter(char const * name, double value) {
+    if (!enabled()) return;
+    record({name, now(), 0, value, 0, 'C'});
+}
+
+uint64_t Trace::flowId() {
+    return enabled() ? next_flow.fetch_add(1, std::memory_order_relaxed) : 0;
+}
+
+void Trace::flowStart(char const * name, uint64_t id) {
+    if (!enabled() || id == 0) return;
+    record({name, now(), 0, 0, id, 's'});
+}
+
+void Trace::flowEnd(char const * name, uint64_t id) {
+    if (!enabled() || id == 0) return;
+    record({name, now(), 0, 0, id, 'f'});
+}
+
+bool Trace::dump(QString const& path) {
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        qWarning() << "Cannot write trace" << path << file.errorString();
+        return false;
+    }
+
+    QTextStream out(&file);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    auto const separator = [&out, &first]() {
+        if (!first) out << ",\n";
+        first = false;
+    };
+
+    QMutexLocker lock(&registry_mutex);
+    for (auto const& buffer : registry) {
+        separator();
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+            << ",\"args\":{\"name\":\"" << buffer->name << "\"}}";
+
+        uint64_t const head = buffer->head.load(std::memory_order_acquire);
+        uint64_t const begin = head > Buffer::CAPACITY ? head - Buffer::CAPACITY : 0;
+        std::vector<Event> events;
+        events.reserve(head - begin);
+        for (uint64_t i = begin; i < head; ++i) {
+            Slot const& slot = buffer->slots[i % Buffer::CAPACITY];
+            uint64_t const stamp = slot.stamp.load(std::memory_order_acquire);
+            if (stamp != 2 * i + 2) continue;
+            Event const event{
+                slot.name.load(std::memory_order_relaxed),
+                slot.ts.load(std::memory_order_relaxed),
+                slot.dur.load(std::memory_order_relaxed),
+                slot.value.load(std::memory_order_relaxed),
+                slot.id.load(std::memory_order_relaxed),
+                slot.phase.load(std::memory_order_relaxed),
+            };
+            // The field loads have to complete before the stamp is checked again
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.stamp.load(std::memory_order_relaxed) != stamp) continue;
+            events.push_back(event);
+        }
+
+        for (Event const& e : events) {
+            separator();
+            out << "{\"name\":\"" << e.name << "\",\"ph\":\"" << e.phase << "\",\"ts\":" << e.ts
+                << ",\"pid\":1,\"tid\":" << buffer->tid;
+            switch (e.phase) {
+                case 'X': out << ",\"dur\":" << e.dur; break;
+                case 'i': out << ",\"s\":\"t\""; break;
+                case 'C': out << ",\"args\":{\"value\":" << e.value << "}"; break;
+                case 's': out << ",\"cat\":\"signal\",\"id\":" << e.id; break;
+                case 'f': out << ",\"cat\":\"signal\",\"id\":" << e.id << ",\"bp\":\"e\""; break;
+            }
+            out << "}";
+        }
+    }
+    out << "]}\n";
+    return out.status() == QTextStream::Ok;
+}
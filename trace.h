@@ -0,0 +1,54 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+#include <atomic>
+#include <stdint.h>
+
+// Trace spans, counters and cross-thread flows, exported as Chrome trace JSON
+// (chrome://tracing, ui.perfetto.dev).
+//
+// Every thread writes into its own ring buffer; only a thread's first event takes a lock, to
+// register that buffer. When tracing is off each call is a single relaxed load.
+// Names must outlive the process (string literals).
+class Trace {
+public:
+    static bool enabled() { return active.load(std::memory_order_relaxed); }
+    static void setEnabled(bool);
+
+    // Microseconds since the trace clock started
+    static int64_t now();
+
+    static void complete(char const * name, int64_t start_us, int64_t duration_us);
+    static void instant(char const * name);
+    static void counter(char const * name, double value);
+
+    // Arrows between threads: a flow started on one thread and ended on another. A zero id,
+    // handed out while tracing is off, records nothing.
+    static uint64_t flowId();
+    static void flowStart(char const * name, uint64_t id);
+    static void flowEnd(char const * name, uint64_t id);
+
+    // Writes everything still in the ring buffers, safe while other threads keep recording
+    static bool dump(QString const& path);
+
+    class Scope {
+    public:
+        explicit Scope(char const * name): name{Trace::enabled() ? name : nullptr}, start{this->name ? Trace::now() : 0} {}
+        ~Scope() { if (this->name) Trace::complete(this->name, this->start, Trace::now() - this->start); }
+        Scope(Scope const&) = delete;
+        Scope & operator=(Scope const&) = delete;
+    private:
+        char const * const name;
+        int64_t const start;
+    };
+
+private:
+    static std::atomic<bool> active;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) Trace::Scope const TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+#endif // TRACE_H
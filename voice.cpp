@@ -0,0 +1,284 @@
+#include "voice.h"
+#include "trace.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace {
+
+constexpr double PI = 3.14159265358979323846;
+constexpr double HARMONICS_DB[] = {-31, -46, -54, -52, -68, -55, -55};
+constexpr int HARMONICS = sizeof(HARMONICS_DB) / sizeof(HARMONICS_DB[0]);
+// Low notes are played louder, relative to this frequency
+constexpr double REFERENCE_FREQUENCY = 440;
+
+std::array<double, HARMONICS> const& harmonicPowers() {
+    static std::array<double, HARMONICS> const powers = []() {
+        std::array<double, HARMONICS> p;
+        for (int h = 0; h < HARMONICS; ++h) {
+            p[h] = std::pow(10, (HARMONICS_DB[h] - HARMONICS_DB[0]) / 10.);
+        }
+        return p;
+    }();
+    return powers;
+}
+
+int16_t saturate(double v) {
+    return static_cast<int16_t>(std::lround(std::clamp<double>(v, INT16_MIN, INT16_MAX)));
+}
+
+int16_t saturate(int32_t v) {
+    return static_cast<int16_t>(std::clamp<int32_t>(v, INT16_MIN, INT16_MAX));
+}
+
+// One period of the summed harmonics at full scale, with the first entry repeated at the end
+// so interpolation never wraps
+struct Wavetable {
+    int16_t samples[Voice<FixedPoint>::TABLE_SIZE + 1];
+    double peak;
+};
+
+Wavetable const& wavetable() {
+    static Wavetable const table = []() {
+        int constexpr size = Voice<FixedPoint>::TABLE_SIZE;
+        double summed[size];
+        double peak = 0;
+        for (int i = 0; i < size; ++i) {
+            summed[i] = 0;
+            for (int h = 0; h < HARMONICS; ++h) {
+                summed[i] += harmonicPowers()[h] * std::sin((h + 1) * 2 * PI * i / size);
+            }
+            peak = std::max(peak, std::abs(summed[i]));
+        }
+        Wavetable t;
+        for (int i = 0; i < size; ++i) {
+            t.samples[i] = saturate(summed[i] / peak * INT16_MAX);
+        }
+        t.samples[size] = t.samples[0];
+        t.peak = peak;
+        return t;
+    }();
+    return table;
+}
+
+}
+
+Voice<double>::Voice(EnvelopeShape shape, int sample_rate):
+    envelope{shape},
+    sample_rate{sample_rate},
+    frequency{0},
+    gain{0},
+    phase_offsets{}
+{
+}
+
+void Voice<double>::play(double frequency) {
+    this->frequency = frequency;
+    this->gain = frequency > 0 ? REFERENCE_FREQUENCY / frequency * INT16_MAX / HARMONICS : 0;
+    std::fill(std::begin(this->phase_offsets), std::end(this->phase_offsets), 0);
+    this->envelope.on();
+}
+
+void Voice<double>::release() {
+    this->envelope.off();
+}
+
+bool Voice<double>::idle() const {
+    return this->envelope.idle();
+}
+
+void Voice<double>::render(int16_t * out, int frames) {
+    auto const& powers = harmonicPowers();
+    double const sample_period = 1. / this->sample_rate;
+
+    for (int i = 0; i < frames; ++i) {
+        double sample = 0;
+        for (int h = 0; h < HARMONICS; ++h) {
+            sample += powers[h] * std::sin(this->phase_offsets[h]);
+            this->phase_offsets[h] += this->frequency * (h + 1) * 2 * PI * sample_period;
+        }
+        out[i] = saturate(sample * this->gain * this->envelope.value());
+        this->envelope.advance(sample_period);
+    }
+
+    // Renormalize phase_offsets
+    for (int h = 0; h < HARMONICS; ++h) {
+        this->phase_offsets[h] = std::fmod(this->phase_offsets[h], 2 * PI);
+    }
+}
+
+Voice<double>::Envelope::Envelope(EnvelopeShape shape):
+    shape{shape},
+    cvalue{0},
+    state{State::IDLE} {
+}
+
+void Voice<double>::Envelope::advance(double dt) {
+    switch (this->state) {
+        case (State::IDLE): break;
+        case (State::ATTACK): {
+            this->cvalue += dt * this->shape.attack;
+            if (this->cvalue >= 1.0) {
+                this->state = State::DECAY;
+                Trace::instant("envelope decay");
+            }
+        } break;
+        case (State::DECAY): {
+            this->cvalue -= dt * this->shape.decay;
+            if (this->cvalue <= this->shape.sustain_value) {
+                this->state = State::SUSTAIN;
+                Trace::instant("envelope sustain");
+            }
+        } break;
+        case (State::SUSTAIN): {
+            this->cvalue -= dt * this->shape.sustain_rate;
+            if (this->cvalue <= 0) {
+                this->state = State::IDLE;
+                Trace::instant("envelope idle");
+            }
+        } break;
+        case (State::RELEASE): {
+            this->cvalue -= dt * this->shape.release;
+            if (this->cvalue <= 0) {
+                this->state = State::IDLE;
+                Trace::instant("envelope idle");
+            }
+        } break;
+    }
+}
+
+double Voice<double>::Envelope::value() const {
+    return this->cvalue;
+}
+
+bool Voice<double>::Envelope::idle() const {
+    return this->state == State::IDLE;
+}
+
+void Voice<double>::Envelope::on() {
+    Trace::instant("envelope attack");
+    this->state = State::ATTACK;
+    this->cvalue = 0;
+}
+
+void Voice<double>::Envelope::off() {
+    Trace::instant("envelope release");
+    this->state = State::RELEASE;
+}
+
+Voice<FixedPoint>::Voice(EnvelopeShape shape, int sample_rate):
+    envelope{shape, sample_rate},
+    sample_rate{sample_rate},
+    phase{0},
+    phase_step{0},
+    gain{0}
+{
+    wavetable();
+}
+
+// The only floating point left: once per note, never per sample
+void Voice<FixedPoint>::play(double frequency) {
+    this->phase = 0;
+    this->phase_step = static_cast<uint32_t>(std::llround(frequency / this->sample_rate * 4294967296.));
+    double const gain = frequency > 0 ? wavetable().peak * REFERENCE_FREQUENCY / frequency / HARMONICS : 0;
+    this->gain = static_cast<int32_t>(std::lround(std::min(gain, 32767.) * 65536));
+    this->envelope.on();
+}
+
+void Voice<FixedPoint>::release() {
+    this->envelope.off();
+}
+
+bool Voice<FixedPoint>::idle() const {
+    return this->envelope.idle();
+}
+
+void Voice<FixedPoint>::render(int16_t * out, int frames) {
+    int16_t const * const table = wavetable().samples;
+    int constexpr fraction_bits = 15;
+
+    for (int i = 0; i < frames; ++i) {
+        uint32_t const index = this->phase >> (32 - TABLE_BITS);
+        int32_t const fraction = (this->phase >> (32 - TABLE_BITS - fraction_bits)) & ((1 << fraction_bits) - 1);
+        int32_t const a = table[index];
+        int32_t const wave = a + (((table[index + 1] - a) * fraction) >> fraction_bits);
+        // Q15 level times Q16 gain, capped so that wave * amplitude stays in 32 bits
+        int32_t const amplitude = static_cast<int32_t>(std::min<int64_t>(
+            (static_cast<int64_t>(this->envelope.value() >> 16) * this->gain) >> 16, 1 << 16));
+        out[i] = saturate((wave * amplitude + (1 << 14)) >> 15);
+
+        this->phase += this->phase_step;
+        this->envelope.advance();
+    }
+}
+
+Voice<FixedPoint>::Envelope::Envelope(EnvelopeShape shape, int sample_rate):
+    level{0},
+    state{State::IDLE}
+{
+    auto const step = [sample_rate](double rate) {
+        return static_cast<int32_t>(std::llround(std::clamp(rate / sample_rate, 0., 1.) * ONE));
+    };
+    this->attack_step = step(shape.attack);
+    this->decay_step = step(shape.decay);
+    this->sustain_level = static_cast<int32_t>(std::llround(std::clamp(shape.sustain_value, 0., 1.) * ONE));
+    this->sustain_step = step(shape.sustain_rate);
+    this->release_step = step(shape.release);
+}
+
+void Voice<FixedPoint>::Envelope::advance() {
+    switch (this->state) {
+        case (State::IDLE): break;
+        case (State::ATTACK): {
+            if (ONE - this->level <= this->attack_step) {
+                this->level = ONE;
+                this->state = State::DECAY;
+                Trace::instant("envelope decay");
+            } else {
+                this->level += this->attack_step;
+            }
+        } break;
+        case (State::DECAY): {
+            this->level -= this->decay_step;
+            if (this->level <= this->sustain_level) {
+                this->state = State::SUSTAIN;
+                Trace::instant("envelope sustain");
+            }
+        } break;
+        case (State::SUSTAIN): {
+            this->level -= this->sustain_step;
+            if (this->level <= 0) {
+                this->level = 0;
+                this->state = State::IDLE;
+                Trace::instant("envelope idle");
+            }
+        } break;
+        case (State::RELEASE): {
+            this->level -= this->release_step;
+            if (this->level <= 0) {
+                this->level = 0;
+                this->state = State::IDLE;
+                Trace::instant("envelope idle");
+            }
+        } break;
+    }
+}
+
+int32_t Voice<FixedPoint>::Envelope::value() const {
+    return this->level;
+}
+
+bool Voice<FixedPoint>::Envelope::idle() const {
+    return this->state == State::IDLE;
+}
+
+void Voice<FixedPoint>::Envelope::on() {
+    Trace::instant("envelope attack");
+    this->state = State::ATTACK;
+    this->level = 0;
+}
+
+void Voice<FixedPoint>::Envelope::off() {
+    Trace::instant("envelope release");
+    this->state = State::RELEASE;
+}
@@ -0,0 +1,113 @@
+#ifndef VOICE_H
+#define VOICE_H
+
+#include <stdint.h>
+
+// One synthesized note: seven harmonics of the fundamental under an ADSR envelope, rendered a
+// block at a time as signed 16 bit samples.
+//
+// Voice<double> is the reference, evaluated in floating point sample by sample. Voice<FixedPoint>
+// renders the same sound with integer arithmetic only, for devices whose FPU is slow or missing:
+// one period of the summed harmonics is tabulated once, a 32 bit phase accumulator walks the
+// table with linear interpolation, and the envelope is a Q31 level moved by precomputed
+// per-sample steps. Synth picks one at compile time (PERFECT_PITCH_FIXED_POINT).
+
+// Rates are in full scale per second, sustain_value in [0, 1]
+struct EnvelopeShape {
+    double attack;
+    double decay;
+    double sustain_value;
+    double sustain_rate;
+    double release;
+};
+
+struct FixedPoint {};
+
+template <typename Arithmetic>
+class Voice;
+
+template <>
+class Voice<double> {
+public:
+    Voice(EnvelopeShape shape, int sample_rate);
+    void play(double frequency);
+    void release();
+    void render(int16_t * out, int frames);
+    // Silent until the next play()
+    bool idle() const;
+
+private:
+    class Envelope {
+    public:
+        explicit Envelope(EnvelopeShape shape);
+        void advance(double dt);
+        double value() const;
+        bool idle() const;
+        void on();
+        void off();
+    private:
+        enum class State {
+            IDLE,
+            ATTACK,
+            DECAY,
+            SUSTAIN,
+            RELEASE
+        };
+        EnvelopeShape shape;
+        double cvalue;
+        State state;
+    };
+
+    Envelope envelope;
+    int sample_rate;
+    double frequency;
+    double gain;
+    double phase_offsets[7];
+};
+
+template <>
+class Voice<FixedPoint> {
+public:
+    Voice(EnvelopeShape shape, int sample_rate);
+    void play(double frequency);
+    void release();
+    void render(int16_t * out, int frames);
+    // Silent until the next play()
+    bool idle() const;
+
+    static constexpr int TABLE_BITS = 11;
+    static constexpr int TABLE_SIZE = 1 << TABLE_BITS;
+
+private:
+    // Level in Q31, moved by a fixed step per sample
+    class Envelope {
+    public:
+        Envelope(EnvelopeShape shape, int sample_rate);
+        void advance();
+        int32_t value() const;
+        bool idle() const;
+        void on();
+        void off();
+    private:
+        static constexpr int32_t ONE = INT32_MAX;
+        enum class State {
+            IDLE,
+            ATTACK,
+            DECAY,
+            SUSTAIN,
+            RELEASE
+        };
+        int32_t attack_step, decay_step, sustain_level, sustain_step, release_step;
+        int32_t level;
+        State state;
+    };
+
+    Envelope envelope;
+    int sample_rate;
+    uint32_t phase;
+    uint32_t phase_step;
+    // Q16, folds in the table's peak and the louder low notes of the reference
+    int32_t gain;
+};
+
+#endif // VOICE_H